@@ -0,0 +1,411 @@
+// Headless flocking benchmark
+// Runs the same ship update as the game (updateShips) on a scene with the same collision objects,
+// but without a window or GL context, and reports the latency of every step and the total throughput.
+// The steps are fixed and the ships are seeded, so the final checksum is the same for every thread count.
+// With --verify the grid queries are compared against brute force on the final flock, a mismatch fails the run.
+// The closed form transforms (composeTRS, normalMatrix) are compared against the glm products they replace as well.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <vector>
+#include <arrrgh.hpp>
+#include <glm/gtx/transform.hpp>
+#include "objects/ship.h"
+#include "objects/shipManager.h"
+#include "objects/box.h"
+#include "objects/flockKernel.h"
+#include "utilities/random.h"
+#include "utilities/transform.h"
+
+std::vector<SceneNode *> SceneNode::collisionObjects;
+
+// The benchmark has no transformation pass, the obstacles are placed directly in world space
+static void placeInWorld(SceneNode* node, const glm::vec3 &worldPos, const glm::vec3 &worldScale) {
+    node->currentModelTransformationMatrix = glm::translate(worldPos) * glm::scale(worldScale);
+    node->updateWorldBounds();
+}
+
+// Same layout as initGame in gamelogic.cpp, only the fields the simulation reads
+// Optionally with a field of small asteroids, to measure how the obstacle queries scale
+static SceneNode* buildScene(unsigned int asteroids, Random &random) {
+    const float sunRadius = 15.0f;
+    const glm::vec3 boxDimensions(250.0f, 250.0f, 250.0f);
+
+    SceneNode* rootNode = new SceneNode(SceneNode::GROUP);
+
+    SceneNode* sunNode = new SceneNode();
+    rootNode->addChild(sunNode);
+    sunNode->scale = glm::vec3(sunRadius);
+    sunNode->boundingBoxDimension = glm::vec3(1.0f * 2.0f + 0.1f);
+    sunNode->hasBoundingBox = true;
+    placeInWorld(sunNode, glm::vec3(0.0f), sunNode->scale);
+    sunNode->hasTinyBoundingBox = true;
+    sunNode->tinyBoundingBoxSize = sunRadius;
+    SceneNode::collisionObjects.push_back(sunNode);
+
+    SceneNode* asteroidNode = new SceneNode();
+    sunNode->addChild(asteroidNode);
+    asteroidNode->position = glm::vec3(-30.0f, 0.0f, 50.0f) * 1.0f/sunNode->scale;
+    asteroidNode->scale = glm::vec3(4.0f) * 1.0f/sunNode->scale;
+    asteroidNode->boundingBoxDimension = glm::vec3(1.0f * 2.0f + 1.0f);
+    asteroidNode->hasBoundingBox = true;
+    placeInWorld(asteroidNode, glm::vec3(-30.0f, 0.0f, 50.0f), glm::vec3(4.0f)); // Does not orbit in the benchmark
+    asteroidNode->hasTinyBoundingBox = true;
+    asteroidNode->tinyBoundingBoxSize = 4.0f;
+    SceneNode::collisionObjects.push_back(asteroidNode);
+    Ship::attractors.push_back(asteroidNode);
+
+    SceneNode* boxNode = new Box(boxDimensions, true);
+    rootNode->addChild(boxNode);
+    boxNode->boundingBoxDimension = boxDimensions;
+    placeInWorld(boxNode, glm::vec3(0.0f), glm::vec3(1.0f));
+    SceneNode::collisionObjects.push_back(boxNode);
+
+    for (unsigned int i = 0; i < asteroids; i++) {
+        SceneNode* asteroid = new SceneNode();
+        rootNode->addChild(asteroid);
+        asteroid->position = random.linearRand(glm::vec3(-110.0f), glm::vec3(110.0f));
+        asteroid->scale = glm::vec3(1.0f + 2.0f * random.nextFloat());
+        asteroid->boundingBoxDimension = glm::vec3(2.0f);
+        asteroid->hasBoundingBox = true;
+        placeInWorld(asteroid, asteroid->position, asteroid->scale);
+        SceneNode::collisionObjects.push_back(asteroid);
+    }
+
+    return rootNode;
+}
+
+// FNV-1a over the bits of the flock state, equal checksums mean bit-identical runs
+static uint64_t flockChecksum(const FlockStore &flock) {
+    const FlockState &s = flock.current();
+    const std::vector<float>* components[] = {&s.posX, &s.posY, &s.posZ, &s.velX, &s.velY, &s.velZ};
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (const std::vector<float>* component : components) {
+        for (float value : *component) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            hash = (hash ^ bits) * 0x100000001B3ull;
+        }
+    }
+    return hash;
+}
+
+// Every enabled ship asks the neighbour grid the same query as getNeighbourSums, the set of ships that pass the
+// kernel's distance test must equal a brute force search over the whole flock, and the kernel must count the same
+// Returns the number of ships with a different answer
+static unsigned int verifyNeighbours() {
+    const FlockStore &flock = Ship::entities.kinematics;
+    const SpatialGrid &grid = Ship::neighbourGrid;
+    const float radius = grid.getCellSize(); // The grid is built with the perception radius as cell size
+    const FlockKernel kernel = getFlockKernel();
+    std::vector<unsigned int> fromGrid, bruteForce;
+    unsigned int mismatches = 0;
+    for (unsigned int slot = 0; slot < flock.size(); slot++) {
+        if (!flock.isEnabled(slot)) continue;
+        const glm::vec3 self = flock.getPosition(slot);
+        fromGrid.clear();
+        bruteForce.clear();
+        FlockSums sums;
+        grid.forEachBucketInRadius(self, radius, [&](const unsigned int* candidates, unsigned int count) {
+            for (unsigned int c = 0; c < count; c++) {
+                const unsigned int i = candidates[c];
+                if (i != slot && glm::length(self - flock.getPosition(i)) <= radius) fromGrid.push_back(i);
+            }
+            kernel(flock, candidates, count, self, slot, radius, sums);
+        });
+        for (unsigned int i = 0; i < flock.size(); i++) {
+            if (i != slot && flock.isEnabled(i) && glm::length(self - flock.getPosition(i)) <= radius) bruteForce.push_back(i);
+        }
+        std::sort(fromGrid.begin(), fromGrid.end()); // Duplicates are kept, a bucket visited twice is a mismatch
+        if (fromGrid != bruteForce || sums.count != bruteForce.size()) mismatches++;
+    }
+    return mismatches;
+}
+
+// Rays from the ships in random directions against the obstacle hierarchy, the boxes forEachRayHit reports
+// (with their intersections) must be exactly the boxes a test against every obstacle hits within the same distance.
+// nearestHit must return the closest of those, with and without a filter that rejects every third box
+// Returns the number of rays with a different answer
+static unsigned int verifyObstacleRays(unsigned int rays, Random &random) {
+    const BoundingVolumeHierarchy &bvh = Ship::obstacles;
+    const FlockStore &flock = Ship::entities.kinematics;
+    typedef std::pair<unsigned int, float> Hit;
+    std::vector<Hit> fromTree, bruteForce;
+    unsigned int mismatches = 0;
+    for (unsigned int i = 0; i < rays; i++) {
+        const glm::vec3 origin = flock.getPosition(i % flock.size());
+        glm::vec3 direction;
+        do { direction = random.ballRand(1.0f); } while (glm::dot(direction, direction) < 1e-6f);
+        const Ray ray = genRay(origin, glm::normalize(direction));
+        const float maxDistance = 300.0f * random.nextFloat(); // Up to across the whole box
+        fromTree.clear();
+        bruteForce.clear();
+        bvh.forEachRayHit(ray, maxDistance, [&](unsigned int index, const RayIntersection &intersection) {
+            fromTree.push_back(Hit(index, intersection.distance));
+        });
+        for (unsigned int index = 0; index < bvh.size(); index++) {
+            RayIntersection intersection = rayBoxIntersect(ray, bvh.getBox(index));
+            if (intersection.intersect && intersection.distance <= maxDistance) bruteForce.push_back(Hit(index, intersection.distance));
+        }
+        std::sort(fromTree.begin(), fromTree.end());
+        bool same = fromTree == bruteForce;
+
+        for (unsigned int filtered = 0; filtered < 2; filtered++) {
+            auto accept = [filtered](unsigned int index) { return filtered == 0 || index % 3 != 0; };
+            float expected = std::numeric_limits<float>::infinity();
+            for (const Hit &hit : bruteForce) {
+                if (accept(hit.first)) expected = std::min(expected, hit.second);
+            }
+            RayIntersection nearest = {};
+            const unsigned int found = bvh.nearestHit(ray, maxDistance, nearest, accept);
+            if (found == bvh.size()) {
+                same = same && std::isinf(expected);
+            } else { // Any box at the nearest distance, ties can go either way
+                same = same && accept(found) && nearest.distance == expected
+                       && std::binary_search(bruteForce.begin(), bruteForce.end(), Hit(found, expected));
+            }
+        }
+        if (!same) mismatches++;
+    }
+    return mismatches;
+}
+
+// Spheres around the ships against the obstacle hierarchy, forEachInRadius must report exactly the boxes
+// whose closest point is within the radius
+// Returns the number of spheres with a different answer
+static unsigned int verifyObstacleSpheres(unsigned int spheres, Random &random) {
+    const BoundingVolumeHierarchy &bvh = Ship::obstacles;
+    const FlockStore &flock = Ship::entities.kinematics;
+    std::vector<unsigned int> fromTree, bruteForce;
+    unsigned int mismatches = 0;
+    for (unsigned int i = 0; i < spheres; i++) {
+        const glm::vec3 center = flock.getPosition(i % flock.size()) + random.ballRand(10.0f);
+        const float radius = 40.0f * random.nextFloat();
+        fromTree.clear();
+        bruteForce.clear();
+        bvh.forEachInRadius(center, radius, [&](unsigned int index) { fromTree.push_back(index); });
+        for (unsigned int index = 0; index < bvh.size(); index++) {
+            const BoundingBox &box = bvh.getBox(index);
+            const glm::vec3 d = center - glm::max(box.min, glm::min(center, box.max));
+            if (glm::dot(d, d) <= radius * radius) bruteForce.push_back(index);
+        }
+        std::sort(fromTree.begin(), fromTree.end());
+        if (fromTree != bruteForce) mismatches++;
+    }
+    return mismatches;
+}
+
+// Segments like the laser sweeps through the neighbour grid, Ship::castAgainstShips must find the same nearest ship
+// as a test against every enabled ship, ignoring the same owner. Half of the segments start at a ship and ignore it,
+// like a laser leaving its owner, the rest start anywhere in the box and ignore a random ship
+// Ties (like a segment starting inside two boxes) may pick either ship, as long as both are hit at that distance
+// Returns the number of segments with a different answer
+static unsigned int verifyLaserCasts(unsigned int casts, Random &random) {
+    const FlockStore &flock = Ship::entities.kinematics;
+    const unsigned int miss = flock.size();
+    std::vector<float> distance(flock.size());
+    auto closeEnough = [](float a, float b) { return std::abs(a - b) <= 1e-4f * (1.0f + std::abs(b)); };
+    unsigned int mismatches = 0;
+    for (unsigned int i = 0; i < casts; i++) {
+        const unsigned int owner = random.next() % flock.size();
+        const glm::vec3 origin = i % 2 == 0 ? flock.getPosition(owner) : random.linearRand(glm::vec3(-125.0f), glm::vec3(125.0f));
+        glm::vec3 direction;
+        do { direction = random.ballRand(1.0f); } while (glm::dot(direction, direction) < 1e-6f);
+        direction = glm::normalize(direction);
+        const float length = 110.0f * random.nextFloat(); // Up to the view distance plus a laser
+        const unsigned int ignoreId = Ship::entities.id[owner];
+
+        float hitDistance;
+        const unsigned int target = Ship::castAgainstShips(origin, direction, length, ignoreId, hitDistance);
+
+        const Ray ray = genRay(origin, direction);
+        unsigned int expected = miss;
+        for (unsigned int slot = 0; slot < flock.size(); slot++) {
+            distance[slot] = std::numeric_limits<float>::infinity();
+            if (!flock.isEnabled(slot) || Ship::entities.id[slot] == ignoreId) continue;
+            const BoundingBox box = genBoundingBox(flock.getPosition(slot), Ship::boundingBoxDimension, Ship::scale);
+            RayIntersection intersection = rayBoxIntersect(ray, box);
+            if (!intersection.intersect) continue;
+            bool inside = box.min.x <= origin.x && origin.x <= box.max.x && box.min.y <= origin.y && origin.y <= box.max.y
+                       && box.min.z <= origin.z && origin.z <= box.max.z;
+            const float d = inside ? 0.0f : intersection.distance;
+            if (d > length) continue;
+            distance[slot] = d;
+            if (expected == miss || d < distance[expected]) expected = slot;
+        }
+
+        bool same = target == expected;
+        if (!same && target != miss && expected != miss) {
+            same = closeEnough(hitDistance, distance[expected]) && closeEnough(distance[target], distance[expected]);
+        }
+        if (same && target != miss) same = closeEnough(hitDistance, distance[target]);
+        if (!same) mismatches++;
+    }
+    return mismatches;
+}
+
+// composeTRS and normalMatrix (utilities/transform.h) against the glm products they replace, on random transforms
+// and on slightly sheared rotations around the tolerance of the orthogonal columns fast path of normalMatrix
+// Returns the number of transforms with a different answer
+static unsigned int verifyTransforms(unsigned int transforms, Random &random) {
+    auto nextFloat = [&random]() { return random.nextFloat() * 2.0f - 1.0f; };
+    auto nextVec = [&nextFloat](float scale) { return glm::vec3(nextFloat(), nextFloat(), nextFloat()) * scale; };
+    auto closeEnough = [](const glm::mat3 &a, const glm::mat3 &b, float tolerance) {
+        float largest = 0.0f;
+        for (int c = 0; c < 3; c++) for (int r = 0; r < 3; r++) largest = std::max(largest, std::abs(b[c][r]));
+        for (int c = 0; c < 3; c++) {
+            for (int r = 0; r < 3; r++) {
+                if (std::abs(a[c][r] - b[c][r]) > tolerance * largest) return false;
+            }
+        }
+        return true;
+    };
+    auto referenceNormalMatrix = [](const glm::mat4 &m) { return glm::transpose(glm::inverse(glm::mat3(m))); };
+
+    unsigned int mismatches = 0;
+    for (unsigned int i = 0; i < transforms; i++) {
+        const glm::vec3 position = nextVec(100.0f), rotation = nextVec(4.0f), referencePoint = nextVec(5.0f);
+        // Every other transform has a uniform scale, the normal matrix of a chain of those takes the fast path
+        const glm::vec3 scale = i % 2 == 0 ? glm::vec3(1.5f + nextFloat()) : nextVec(1.0f) + glm::vec3(1.5f);
+        const glm::mat4 expected = glm::translate(position) * glm::translate(referencePoint)
+                * glm::rotate(rotation.y, glm::vec3(0.0f, 1.0f, 0.0f))
+                * glm::rotate(rotation.x, glm::vec3(1.0f, 0.0f, 0.0f))
+                * glm::rotate(rotation.z, glm::vec3(0.0f, 0.0f, 1.0f))
+                * glm::scale(scale) * glm::translate(-referencePoint);
+        const glm::mat4 actual = composeTRS(position, rotation, scale, referencePoint);
+        bool same = closeEnough(glm::mat3(actual), glm::mat3(expected), 1e-5f)
+                && glm::length(glm::vec3(actual[3]) - glm::vec3(expected[3])) <= 1e-5f * std::max(1.0f, glm::length(glm::vec3(expected[3])));
+
+        // A parent with a uniform scale keeps the columns orthogonal, a non uniform child under it shears the chain
+        const glm::mat4 parent = composeTRS(nextVec(100.0f), nextVec(4.0f), glm::vec3(1.5f + nextFloat()));
+        const glm::mat4 world = parent * actual;
+        same = same && closeEnough(normalMatrix(world), referenceNormalMatrix(world), 1e-4f);
+        if (!same) mismatches++;
+    }
+
+    // Shears just under and over the tolerance, the fast path must still be close to the true inverse transpose
+    const float shears[] = {1e-7f, 1e-6f, 5e-6f, 1e-5f, 2e-5f, 1e-4f, 1e-3f};
+    for (float shear : shears) {
+        glm::mat4 sheared(1.0f);
+        sheared[1][0] = shear;
+        const glm::mat4 world = composeTRS(nextVec(100.0f), nextVec(4.0f), glm::vec3(2.0f)) * sheared;
+        if (!closeEnough(normalMatrix(world), referenceNormalMatrix(world), 1e-4f)) mismatches++;
+    }
+    return mismatches;
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+    size_t index = (size_t) (p * (double) (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+int main(int argc, const char* argb[]) {
+    arrrgh::parser parser("flockbench", "Headless benchmark of the flocking simulation");
+    const auto& showHelp = parser.add<bool>("help", "Show this help message.", 'h', arrrgh::Optional, false);
+    const auto& shipCount = parser.add<int>("ships", "Number of ships.", 'n', arrrgh::Optional, 2000);
+    const auto& stepCount = parser.add<int>("steps", "Number of measured steps.", 'k', arrrgh::Optional, 1000);
+    const auto& warmupCount = parser.add<int>("warmup", "Number of steps before measuring.", 'w', arrrgh::Optional, 50);
+    const auto& threadCount = parser.add<int>("threads", "Threads updating the ships (including the main thread), 1 runs serially, 0 for one per hardware thread.", 't', arrrgh::Optional, 0);
+    const auto& pinThreads = parser.add<bool>("pin-threads", "Pin every worker thread to its own core.", 'p', arrrgh::Optional, false);
+    const auto& asteroidCount = parser.add<int>("asteroids", "Number of extra small obstacles.", 'a', arrrgh::Optional, 0);
+    const auto& tickRate = parser.add<int>("tick-rate", "Simulation ticks per second, the fixed step is 1/tick-rate.", 'r', arrrgh::Optional, 60);
+    const auto& seed = parser.add<int>("seed", "Seed of the ship placement and the ships random generators.", 's', arrrgh::Optional, 1);
+    const auto& stagger = parser.add<int>("stagger", "Redo the staggered ship work (neighbours, obstacles, laser targeting) every k steps, 0 keeps the game defaults.", 'g', arrrgh::Optional, 0);
+    const auto& verify = parser.add<bool>("verify", "Compare the grid queries against brute force after the last step.", 'v', arrrgh::Optional, false);
+
+    try {
+        parser.parse(argc, argb);
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing arguments: " << e.what() << std::endl;
+        parser.show_usage(std::cerr);
+        return 1;
+    }
+    if (showHelp.value()) {
+        parser.show_usage(std::cout);
+        return 0;
+    }
+
+    const unsigned int ships = (unsigned int) std::max(shipCount.value(), 1);
+    const unsigned int steps = (unsigned int) std::max(stepCount.value(), 1);
+    const unsigned int warmup = (unsigned int) std::max(warmupCount.value(), 0);
+    const double deltaTime = 1.0 / std::max(tickRate.value(), 1);
+
+    // One thread means no scheduler at all, the same path as the game with multithreading off
+    TaskScheduler* scheduler = nullptr;
+    if (threadCount.value() != 1) {
+        const unsigned int workers = threadCount.value() > 1 ? (unsigned int) threadCount.value() - 1 : 0;
+        scheduler = new TaskScheduler(workers, pinThreads.value());
+    }
+    const unsigned int threads = scheduler != nullptr ? scheduler->workerCount() + 1 : 1;
+
+    if (stagger.value() > 0) Ship::stagger.setAllPeriods((unsigned int) stagger.value());
+
+    Random placement((uint64_t) seed.value());
+    SceneNode* rootNode = buildScene((unsigned int) std::max(asteroidCount.value(), 0), placement);
+
+    // The game spawns every ship in one spot, spread them out to measure a settled flock from the first step
+    Ship::randomSeed = (unsigned int) seed.value();
+    for (unsigned int i = 0; i < ships; i++) {
+        const unsigned int slot = Ship::spawn();
+        Ship::setPosition(slot, placement.linearRand(glm::vec3(-120.0f), glm::vec3(120.0f)));
+    }
+
+    printf("flockbench: %u ships, %u obstacles, %u steps (+%u warmup), %u threads, %s flock kernel, neighbours every %u steps\n",
+           ships, (unsigned int) SceneNode::collisionObjects.size(), steps, warmup, threads, getFlockKernelName(),
+           Ship::stagger.getPeriod(StaggerSchedule::NEIGHBOURS));
+
+    for (unsigned int i = 0; i < warmup; i++) {
+        updateShips(deltaTime, scheduler);
+    }
+
+    std::vector<double> stepMs;
+    stepMs.reserve(steps);
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < steps; i++) {
+        const auto stepStart = std::chrono::steady_clock::now();
+        updateShips(deltaTime, scheduler);
+        const auto stepEnd = std::chrono::steady_clock::now();
+        stepMs.push_back(std::chrono::duration<double, std::milli>(stepEnd - stepStart).count());
+    }
+    const double totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::sort(stepMs.begin(), stepMs.end());
+    printf("step latency (ms): min %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+           stepMs.front(), percentile(stepMs, 0.5), percentile(stepMs, 0.9), percentile(stepMs, 0.99), stepMs.back());
+    printf("throughput: %.0f ship-steps/s (%.2f s total)\n", (double) ships * steps / totalSeconds, totalSeconds);
+    printf("flock checksum: %016llx\n", (unsigned long long) flockChecksum(Ship::entities.kinematics));
+    unsigned long long hits = 0;
+    for (const ShipWeapon &weapon : Ship::entities.weapon) hits += weapon.hits;
+    printf("lasers: %u in flight, %llu hits\n", Ship::lasers.size(), hits);
+
+    bool verified = true;
+    if (verify.value()) {
+        Ship::updateNeighbourGrid(); // The last step swapped in new positions
+        const unsigned int neighbourMismatches = verifyNeighbours();
+        printf("verify: neighbour sets of %u ships, %u mismatches\n", Ship::neighbourGrid.size(), neighbourMismatches);
+        const unsigned int obstacleRays = 100000;
+        const unsigned int obstacleMismatches = verifyObstacleRays(obstacleRays, placement);
+        printf("verify: %u rays against %u obstacles, %u mismatches\n", obstacleRays, Ship::obstacles.size(), obstacleMismatches);
+        const unsigned int obstacleSpheres = 100000;
+        const unsigned int sphereMismatches = verifyObstacleSpheres(obstacleSpheres, placement);
+        printf("verify: %u spheres against %u obstacles, %u mismatches\n", obstacleSpheres, Ship::obstacles.size(), sphereMismatches);
+        const unsigned int laserCasts = 300000;
+        const unsigned int laserMismatches = verifyLaserCasts(laserCasts, placement);
+        printf("verify: %u laser segments against the ships, %u mismatches\n", laserCasts, laserMismatches);
+        const unsigned int transforms = 1000;
+        const unsigned int transformMismatches = verifyTransforms(transforms, placement);
+        printf("verify: %u transforms against the glm products, %u mismatches\n", transforms, transformMismatches);
+        verified = neighbourMismatches == 0 && obstacleMismatches == 0 && sphereMismatches == 0 && laserMismatches == 0
+                   && transformMismatches == 0;
+    }
+
+    delete rootNode;
+    delete scheduler;
+    return verified ? 0 : 1;
+}
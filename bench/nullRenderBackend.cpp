@@ -0,0 +1,14 @@
+// Stand-in for utilities/glutils.cpp without an OpenGL context
+// The simulation only stores the returned ids in the scene nodes, it never draws them
+
+#include "utilities/glutils.h"
+
+unsigned int generateBuffer(Mesh &mesh) {
+    (void) mesh;
+    return 0;
+}
+
+unsigned int getTextureID(PNGImage* img) {
+    (void) img;
+    return 0;
+}
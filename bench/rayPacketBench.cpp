@@ -0,0 +1,91 @@
+// Microbenchmark of the ray-vs-box packet API against the scalar rayBoxIntersect
+// Both directions are measured: one ray against packets of boxes, and packets of rays against one box.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <arrrgh.hpp>
+#include <iostream>
+#include "utilities/RayBoxIntersect.h"
+#include "utilities/random.h"
+
+// Keeps the compiler from dropping the measured work
+static volatile unsigned int sink;
+
+template<typename F>
+static double measureNs(unsigned int repeats, unsigned int testsPerRepeat, const F &body) {
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned int r = 0; r < repeats; r++) body();
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / ((double) repeats * testsPerRepeat);
+}
+
+int main(int argc, const char* argb[]) {
+    arrrgh::parser parser("raypacketbench", "Microbenchmark of the ray-vs-box packet tests");
+    const auto& showHelp = parser.add<bool>("help", "Show this help message.", 'h', arrrgh::Optional, false);
+    const auto& pairCount = parser.add<int>("pairs", "Ray-box pairs per repeat (rounded up to a packet).", 'n', arrrgh::Optional, 4096);
+    const auto& repeatCount = parser.add<int>("repeats", "Number of repeats.", 'r', arrrgh::Optional, 2000);
+
+    try {
+        parser.parse(argc, argb);
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing arguments: " << e.what() << std::endl;
+        parser.show_usage(std::cerr);
+        return 1;
+    }
+    if (showHelp.value()) {
+        parser.show_usage(std::cout);
+        return 0;
+    }
+
+    const unsigned int packets = ((unsigned int) std::max(pairCount.value(), 1) + rayPacketSize - 1) / rayPacketSize;
+    const unsigned int pairs = packets * rayPacketSize;
+    const unsigned int repeats = (unsigned int) std::max(repeatCount.value(), 1);
+
+    // Ships sized boxes and rays around them, roughly half of the pairs hit
+    Random random(7);
+    std::vector<Ray> rays;
+    std::vector<BoundingBox> boxes;
+    std::vector<RayPacket> rayPackets(packets);
+    std::vector<BoxPacket> boxPackets(packets);
+    for (unsigned int i = 0; i < pairs; i++) {
+        glm::vec3 center = random.linearRand(glm::vec3(-50.0f), glm::vec3(50.0f));
+        boxes.push_back(genBoundingBox(center, glm::vec3(4.0f, 6.0f, 8.0f), glm::vec3(1.0f)));
+        glm::vec3 origin = random.linearRand(glm::vec3(-50.0f), glm::vec3(50.0f));
+        rays.push_back(genRay(origin, center + random.ballRand(6.0f) - origin));
+        rayPackets[i / rayPacketSize].set(i % rayPacketSize, rays.back());
+        boxPackets[i / rayPacketSize].set(i % rayPacketSize, boxes.back());
+    }
+    const Ray &oneRay = rays.front();
+    const BoundingBox &oneBox = boxes.front();
+    alignas(32) float distance[rayPacketSize];
+
+    printf("raypacketbench: %u pairs x %u repeats, %s packet kernel\n", pairs, repeats, getRayPacketKernelName());
+
+    // One ray, many boxes
+    double scalar = measureNs(repeats, pairs, [&]() {
+        unsigned int hits = 0;
+        for (const BoundingBox &box : boxes) hits += rayBoxIntersect(oneRay, box).intersect;
+        sink = hits;
+    });
+    double packet = measureNs(repeats, pairs, [&]() {
+        unsigned int hits = 0;
+        for (const BoxPacket &p : boxPackets) hits += rayBoxIntersectPacket(oneRay, p, rayPacketSize, distance) != 0;
+        sink = hits;
+    });
+    printf("1 ray x 8 boxes: scalar %.2f ns/test, packet %.2f ns/test, %.2fx\n", scalar, packet, scalar / packet);
+
+    // Many rays, one box
+    scalar = measureNs(repeats, pairs, [&]() {
+        unsigned int hits = 0;
+        for (const Ray &ray : rays) hits += rayBoxIntersect(ray, oneBox).intersect;
+        sink = hits;
+    });
+    packet = measureNs(repeats, pairs, [&]() {
+        unsigned int hits = 0;
+        for (const RayPacket &p : rayPackets) hits += rayBoxIntersectPacket(p, oneBox, rayPacketSize, distance) != 0;
+        sink = hits;
+    });
+    printf("8 rays x 1 box:  scalar %.2f ns/test, packet %.2f ns/test, %.2fx\n", scalar, packet, scalar / packet);
+    return 0;
+}
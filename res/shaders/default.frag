@@ -5,6 +5,7 @@ in layout(location = 0) vec3 normalUniform;
 in layout(location = 1) vec2 textureCoordinates;
 in layout(location = 3) vec3 fragPos;
 in layout(location = 4) mat3 tbn;
+flat in layout(location = 7) vec3 instanceColor;
 
 // Uniforms
 uniform layout(location = 10) vec3 cameraPos;
@@ -20,6 +21,7 @@ uniform layout(location = 9) int useRoughnessMap;
 uniform layout(binding = 3) sampler2D samplerRoughness;
 
 uniform layout(location = 12) int ignoreLight = 0;
+uniform layout(location = 13) int useInstancing = 0; // Base color from the instance instead of the material
 
 out vec4 color;
 
@@ -131,7 +133,7 @@ void main()
     if (useTexture == 1) {
         color = texture(samplerTexture, textureCoordinates) * color;
     } else {
-        color = vec4(color.rgb * material.baseColor, color.a);
+        color = vec4(color.rgb * (useInstancing == 1 ? instanceColor : material.baseColor), color.a);
     }
 
     color = color + dither(textureCoordinates);
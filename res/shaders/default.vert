@@ -7,17 +7,37 @@ in layout(location = 2) vec2 textureCoordinates_in;
 in layout(location = 3) vec3 tangents_in;
 in layout(location = 4) vec3 biTangens_in;
 
-uniform layout(location = 3) mat4 MVP;
-uniform layout(location = 4) mat4 M;
-uniform layout(location = 5) mat3 normalMatrix;
+// Per instance (ships), replace the matrix uniforms and the material color when useInstancing is set
+in layout(location = 5) mat4 instanceMVP; // 5-8
+in layout(location = 9) vec4 instanceModelRow0; // The bottom row of the model matrix is always 0 0 0 1
+in layout(location = 10) vec4 instanceModelRow1;
+in layout(location = 11) vec4 instanceModelRow2;
+in layout(location = 12) mat3 instanceNormalMatrix; // 12-14
+in layout(location = 15) vec3 instanceColor;
+
+uniform layout(location = 3) mat4 MVP_uniform;
+uniform layout(location = 4) mat4 M_uniform;
+uniform layout(location = 5) mat3 normalMatrix_uniform;
+uniform layout(location = 13) int useInstancing = 0;
 
 out layout(location = 0) vec3 normal_out;
 out layout(location = 1) vec2 textureCoordinates_out;
 out layout(location = 3) vec3 fragPos_out;
 out layout(location = 4) mat3 tbn_out;
+flat out layout(location = 7) vec3 instanceColor_out;
 
 void main()
 {
+    mat4 MVP = MVP_uniform;
+    mat4 M = M_uniform;
+    mat3 normalMatrix = normalMatrix_uniform;
+    if (useInstancing == 1) {
+        MVP = instanceMVP;
+        M = transpose(mat4(instanceModelRow0, instanceModelRow1, instanceModelRow2, vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+        normalMatrix = instanceNormalMatrix;
+    }
+    instanceColor_out = instanceColor;
+
     textureCoordinates_out = textureCoordinates_in;
 
     vec4 pos4 = vec4(position, 1.0f);
@@ -3,6 +3,8 @@
 #include <utilities/shader.hpp>
 #include <glm/vec3.hpp>
 #include <iostream>
+#include <random>
+#include <chrono>
 #include <utilities/timeutils.h>
 #include <utilities/mesh.h>
 #include <utilities/shapes.h>
@@ -15,8 +17,11 @@
 #include "utilities/imageLoader.hpp"
 #include "objects/ship.h"
 #include "objects/shipManager.h"
+#include "objects/sceneTransforms.h"
+#include "utilities/matrixBatch.h"
 #include "utilities/camera.hpp"
-#include <ThreadPool.h>
+#include <utilities/taskScheduler.h>
+#include <utilities/parallelFor.h>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/transform.hpp>
 #include <utilities/buttonHandler.h>
@@ -29,10 +34,11 @@ SceneNode* boxNode;
 SceneNode* sunNode;
 SceneNode* asteroidNode;
 SceneNode* sunLightNode;
-SceneNode* botsTeam;
+SceneTransforms sceneTransforms; // Flattened copy of the graph under rootNode, for the per frame transforms
+bool shipTransformsStale = true; // Ships moved or were added since their matrices were last built
+glm::mat4 shipVP; // View-projection of the ship MVPs
 
 #define DEFAULT_ALLOWED_BOTS 300
-std::vector <Ship*> bots;
 
 std::vector<SceneNode *> SceneNode::collisionObjects;
 
@@ -43,15 +49,45 @@ Gloom::Shader* defaultShader;
 Gloom::Shader* skyBoxShader;
 unsigned int skyBoxTextureID;
 
+// Uniform locations of the default shader, looked up once so drawing a node builds no strings
+GLint materialBaseColorLocation;
+GLint materialShininessLocation;
+std::vector<GLint> pointLightPositionLocations; // Indexed by lightSourceID, filled when the light is set up
+
+// All lasers are streamed into one vertex buffer every frame and drawn with a single call
+unsigned int laserVAO;
+unsigned int laserVBO;
+std::vector<float> laserVertices;
+
+// All ships are drawn with one instanced call, the per ship data comes from this buffer (attributes 5-15 of default.vert)
+struct ShipInstance {
+    glm::mat4 mvp;
+    glm::vec4 modelRows[3]; // The bottom row of the model matrix is always 0 0 0 1
+    glm::mat3 normal;
+    glm::vec3 color;
+};
+static_assert(sizeof(ShipInstance) == 40 * sizeof(float), "ShipInstance must be tightly packed for the attribute offsets");
+unsigned int shipInstanceVBO;
+std::vector<ShipInstance> shipInstances;
+bool shipInstancesStale = true; // The ship matrices changed since the instance buffer was last uploaded
+
 const glm::vec3 boxDimensions(250.0f, 250.0f, 250.0f);
 const double sunRadius = 15.0f;
 const glm::vec3 sunPosition(0, 0, 0);
 
 CommandLineOptions options;
 
-ThreadPool pool(std::max(std::thread::hardware_concurrency(), (unsigned int) 2));
+TaskScheduler* scheduler; // Heap allocated, the worker count comes from the command line options
 bool useMultiThread = false;
 
+// Fixed step mode, see CommandLineOptions
+double simulationTimeAccumulator = 0;
+const unsigned int maxTicksPerFrame = 8; // Drop time instead of falling further behind when a frame is slow
+
+// Measured work of the last frame, drives the adaptive ship count
+double simulationMs = 0;
+double renderMs = 0;
+
 bool captureMouse = true; // A must for debugging as opengl steals the mouse
 bool isPaused = true;
 
@@ -72,6 +108,18 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
 
     options = gameOptions;
 
+    scheduler = new TaskScheduler(options.workerThreads, options.pinThreads);
+    std::cout << fmt::format("Using {} worker threads{}.", scheduler->workerCount(), options.pinThreads ? " pinned to cores" : "") << std::endl;
+
+    // Must be set before the first ship is created
+    Ship::escapeDirectionCount = options.escapeDirections;
+    Ship::randomSeed = options.seed != 0 ? options.seed : std::random_device()();
+    std::cout << fmt::format("Random seed {}.", Ship::randomSeed) << std::endl;
+    setFrameBudget(options.frameBudgetMs);
+    if (options.fixedTimeStep) {
+        std::cout << fmt::format("Fixed step mode, {} ticks per second.", options.tickRate) << std::endl;
+    }
+
     if (captureMouse) {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
         glfwSetCursorPosCallback(window, mouseCallback);
@@ -83,6 +131,8 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
     defaultShader = new Gloom::Shader();
     defaultShader->makeBasicShader(relativePath + "res/shaders/default.vert", relativePath + "res/shaders/default.frag");
     defaultShader->activate();
+    materialBaseColorLocation = defaultShader->getUniformFromName("material.baseColor");
+    materialShininessLocation = defaultShader->getUniformFromName("material.shininess");
 
     skyBoxShader = new Gloom::Shader();
     skyBoxShader->makeBasicShader(relativePath + "res/shaders/skybox.vert", relativePath +"res/shaders/skybox.frag");
@@ -145,6 +195,9 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
     placeLight3fvVal(sunLightNode->lightSourceID, "ambientColor", c);
     placeLight3fvVal(sunLightNode->lightSourceID, "diffuseColor", c);
     placeLight3fvVal(sunLightNode->lightSourceID, "specularColor", c);
+    pointLightPositionLocations.resize(sunLightNode->lightSourceID + 1, -1);
+    pointLightPositionLocations[sunLightNode->lightSourceID] =
+            defaultShader->getUniformFromName(fmt::format("pointLights[{}].position", sunLightNode->lightSourceID));
     sunNode->addChild(sunLightNode);
 
     // Configuration of box node
@@ -168,18 +221,35 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
     //boxNode->normalMapTextureID = brickNormalTextureID;
     //boxNode->roughnessMapID = brickRoughMapID;
 
-    // Init and configure bots node
-    botsTeam = new SceneNode(SceneNode::GROUP);
-    botsTeam->setStaticMat();
-    rootNode->addChild(botsTeam);
-
+    // Bots, they are entities in Ship::entities and not part of the scene graph
     for (int i=0; i<DEFAULT_ALLOWED_BOTS; i++) {
-        Ship* ship = new Ship();
-        bots.push_back(ship);
-        botsTeam->addChild(ship); // Add it to be rendered
+        Ship::spawn();
     }
-    bots.at(0)->generateLaser(); // Lazy fix for race condition (Note implement better cache structure) or pre-init
-    bots.at(0)->lasers.at(0)->enabled = false;
+
+    // Instance buffer on the shared ship mesh, advanced once per ship instead of once per vertex
+    glBindVertexArray((GLuint) Ship::vertexArrayObjectID);
+    glGenBuffers(1, &shipInstanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, shipInstanceVBO);
+    auto instanceAttribute = [](GLuint location, GLint size, size_t offset) {
+        glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, sizeof(ShipInstance), (void*) offset);
+        glEnableVertexAttribArray(location);
+        glVertexAttribDivisor(location, 1);
+    };
+    const size_t modelRowsOffset = sizeof(glm::mat4);
+    const size_t normalOffset = modelRowsOffset + 3 * sizeof(glm::vec4);
+    const size_t colorOffset = normalOffset + sizeof(glm::mat3);
+    for (unsigned int c = 0; c < 4; c++) instanceAttribute(5 + c, 4, c * sizeof(glm::vec4));
+    for (unsigned int r = 0; r < 3; r++) instanceAttribute(9 + r, 4, modelRowsOffset + r * sizeof(glm::vec4));
+    for (unsigned int c = 0; c < 3; c++) instanceAttribute(12 + c, 3, normalOffset + c * sizeof(glm::vec3));
+    instanceAttribute(15, 3, colorOffset);
+
+    // Laser buffer, only positions, the data is uploaded by renderLasers()
+    glGenVertexArrays(1, &laserVAO);
+    glBindVertexArray(laserVAO);
+    glGenBuffers(1, &laserVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, laserVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, nullptr);
+    glEnableVertexAttribArray(0);
 
     //GLfloat lineWidthRange[2];
     //glGetFloatv(GL_ALIASED_LINE_WIDTH_RANGE, lineWidthRange);
@@ -189,6 +259,9 @@ void initGame(GLFWwindow* window, CommandLineOptions gameOptions) {
 
     std::cout << fmt::format("Initialized scene with (ish) {} SceneNodes in {} seconds.", rootNode->totalChildren(), upstartTime) << std::endl;
 
+    std::cout << fmt::format("Using the {} flock kernel.", getFlockKernelName()) << std::endl;
+    std::cout << fmt::format("Using the {} matrix batch kernels.", getMatrixBatchKernelName()) << std::endl;
+
     std::cout << "Ready. Click to start!" << std::endl;
 
     // Debug settings
@@ -214,8 +287,8 @@ void handleKeyboardInputGameLogic(GLFWwindow* window) {
 
     // Spawn lasers on all ships
     if (getAndSetKeySinglePress(GLFW_MOUSE_BUTTON_1)) {
-        for (Ship *s : bots) {
-            s->generateLaser();
+        for (unsigned int slot = 0; slot < Ship::entities.size(); slot++) {
+            Ship::generateLaser(slot);
         }
     }
 
@@ -241,18 +314,13 @@ void handleKeyboardInputGameLogic(GLFWwindow* window) {
     }
 
     if (keyInUse(GLFW_KEY_F8)) {
-        Ship* ship = new Ship();
-        bots.push_back(ship);
-        botsTeam->addChild(ship);
+        addBots(1);
+        shipTransformsStale = true;
     }
 
     if (keyInUse(GLFW_KEY_F7)) {
-        int index = bots.size()-1;
-        assert(bots.at(index) == botsTeam->children.at(index));
-        Ship * ship = bots.at(index);
-        bots.erase(bots.begin() + index);
-        botsTeam->children.erase(botsTeam->children.begin() + index);
-        delete ship;
+        removeBots(1);
+        shipTransformsStale = true;
     }
 
     if (getAndSetKeySinglePress(GLFW_KEY_F1)) {
@@ -284,54 +352,62 @@ void handleKeyboardInputGameLogic(GLFWwindow* window) {
                "  Multithread: %i\n"
                "  Mouselock:   %i\n"
                "  Box status:  %i\n"
-               "  Bots:        %i\n",
-               isPaused, useMultiThread, captureMouse, boxNode->enabled, (int)bots.size());
+               "  Bots:        %i\n"
+               "  Stagger:     neighbours every %u frames, anti collision every %u frames\n",
+               isPaused, useMultiThread, captureMouse, boxNode->enabled, (int)Ship::entities.size(),
+               Ship::stagger.getPeriod(StaggerSchedule::NEIGHBOURS), Ship::stagger.getPeriod(StaggerSchedule::ANTI_COLLISION));
     }
 }
 
 int frameCount=0;
 double sumTimeDelta=0;
+// Advance everything that is simulated by one step
+void updateSimulation(double timeDelta) {
+    // Sun rotating
+    sunNode->rotation.y = std::fmod(sunNode->rotation.y - timeDelta/3.0f, 360.0f);
+    asteroidNode->rotation.y += timeDelta/2.0f;
+
+    // Update all bots
+    //Ship::printShip(0);
+    updateShips(timeDelta, useMultiThread ? scheduler : nullptr);
+    shipTransformsStale = true;
+}
+
 void updateFrame(GLFWwindow* window) {
 
     double timeDelta = getTimeDeltaSeconds();
 
     // FPS estimate
-    // Also responsible for adaptive bots amount
     frameCount++;
     sumTimeDelta += timeDelta;
     if (sumTimeDelta > 2.0f) {
         float fps = ((float)frameCount/(float)sumTimeDelta);
-        if (!isPaused) updateAmountBots(bots, botsTeam, fps, sumTimeDelta);
-        printf("FPS: %f\n", fps);
+        printf("FPS: %f (simulation %.2f ms, render %.2f ms, %i bots)\n", fps, simulationMs, renderMs, (int)Ship::entities.size());
         frameCount = 0;
         sumTimeDelta = 0;
     }
 
+    // The number of ships would depend on the frame time, so it is kept as is in fixed step mode
+    if (!isPaused && !options.fixedTimeStep) updateAmountBots((float) (simulationMs + renderMs), timeDelta);
+
     // Handle keyboard input
     handleKeyboardInputGameLogic(window);
 
     // Gamelogic
+    const auto simulationStart = std::chrono::steady_clock::now();
     if (!isPaused) {
-
-        // Sun rotating
-        sunNode->rotation.y = std::fmod(sunNode->rotation.y - timeDelta/3.0f, 360.0f);
-        asteroidNode->rotation.y += timeDelta/2.0f;
-
-        // Update all bots
-        //bots.at(0).printShip();
-        std::vector<std::future<void>> futures;
-        auto updS = [](Ship* &ship, double &timeDelta, std::vector<Ship *> &bots) {return ship->updateShip(timeDelta, bots);};
-        for (unsigned int i=0; i < bots.size(); i++) {
-            if (useMultiThread) {
-                // enqueue and store future
-                futures.push_back(pool.enqueue(updS, bots.at(i), timeDelta, bots));
-            } else {
-                bots.at(i)->updateShip(timeDelta, bots);
+        if (options.fixedTimeStep) {
+            const double tick = 1.0 / options.tickRate;
+            simulationTimeAccumulator += timeDelta;
+            unsigned int ticks = 0;
+            while (simulationTimeAccumulator >= tick && ticks < maxTicksPerFrame) {
+                updateSimulation(tick);
+                simulationTimeAccumulator -= tick;
+                ticks++;
             }
-        }
-
-        for (auto &future : futures) {
-            future.get();
+            if (ticks == maxTicksPerFrame) simulationTimeAccumulator = 0;
+        } else {
+            updateSimulation(timeDelta);
         }
     }
 
@@ -347,71 +423,15 @@ void updateFrame(GLFWwindow* window) {
     glm::vec4 asteroidNodePos = asteroidNode->currentModelTransformationMatrix*glm::vec4(0.0f,0.0f,0.0f,1.0f);
     glUniform3fv(11, 1, glm::value_ptr(asteroidNodePos));
 
-    updateNodeTransformations(rootNode, VP, glm::mat4(1.0f));
-}
-
-void updateNodeTransformations(SceneNode* node, glm::mat4 VP, glm::mat4 transformationThusFar) {
-    glm::mat4 transformationMatrix;
-    if (!node->staticRefScaleRot){
-        transformationMatrix =
-                glm::translate(node->position)
-                * glm::translate(node->referencePoint)
-                * glm::rotate(node->rotation.y, glm::vec3(0,1,0))
-                * glm::rotate(node->rotation.x, glm::vec3(1,0,0))
-                * glm::rotate(node->rotation.z, glm::vec3(0,0,1))
-                * glm::scale(node->scale)
-                * glm::translate(-node->referencePoint);
-    } else {
-        transformationMatrix = glm::translate(node->position)
-                             * node->refScaleRot;
-    }
-
-    // Projection*View * Model
-    node->currentModelTransformationMatrix = transformationThusFar * transformationMatrix; // M
-    node->currentTransformationMatrix = VP * node->currentModelTransformationMatrix; // MVP
-
-    node->worldPos = glm::vec3(node->currentModelTransformationMatrix*glm::vec4(0.0f,0.0f,0.0f,1.0f));
-
-
-    // Compute transpose of the inverse of the model matrix
-    // To fix normals inside the shader
-    // https://stackoverflow.com/questions/10879864/what-extractly-mat3a-mat4-matrix-statement-in-glsl-do
-    node->currentNormalMatrix = glm::mat3(glm::transpose(glm::inverse(node->currentModelTransformationMatrix)));
-
-    switch(node->nodeType) {
-        case SceneNode::POINT_LIGHT:
-
-            break;
-        case SceneNode::GEOMETRY: break;
-        case SceneNode::GEOMETRY_NORMAL_MAPPED: break;
-        case SceneNode::GROUP: break;
-        case SceneNode::LINE: break;
-    }
-
-    std::vector<std::future<void>> futures;
-    for(SceneNode* child : node->children) {
-        assert(child != node);
-        if (useMultiThread) {
-            futures.push_back(pool.enqueue(updateNodeTransformations, child, VP, node->currentModelTransformationMatrix));
-        } else {
-            updateNodeTransformations(child, VP, node->currentModelTransformationMatrix);
-        }
-    }
-
-    if (node->getIndependentChildrenSize() > 0) {
-        for (SceneNode* child : node->getIndependentChildren()) {
-            if (useMultiThread && false) { //disabled as it overloads the thread-framework OR creates a weird race condition TODO
-                futures.push_back(pool.enqueue(updateNodeTransformations, child, VP, transformationThusFar));
-            } else {
-                updateNodeTransformations(child, VP, transformationThusFar);
-            }
-        }
-    }
-
-    // Wait for all threads to finish
-    for (std::future<void> &a : futures) {
-        a.get();
+    sceneTransforms.update(rootNode, VP, useMultiThread ? scheduler : nullptr);
+    if (shipTransformsStale || VP != shipVP) {
+        if (shipTransformsStale) updateShipTransforms(useMultiThread ? scheduler : nullptr);
+        updateShipMVPs(VP, useMultiThread ? scheduler : nullptr);
+        shipTransformsStale = false;
+        shipInstancesStale = true;
+        shipVP = VP;
     }
+    simulationMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - simulationStart).count();
 }
 
 void renderNode(SceneNode* node) {
@@ -425,10 +445,8 @@ void renderNode(SceneNode* node) {
 
         // Set object material
         if (node->vertexArrayObjectID != -1) {
-            GLint location = defaultShader->getUniformFromName("material.baseColor");
-            glUniform3fv(location, 1, glm::value_ptr(node->material.baseColor));
-            location = defaultShader->getUniformFromName("material.shininess");
-            glUniform1f(location, node->material.shininess);
+            glUniform3fv(materialBaseColorLocation, 1, glm::value_ptr(node->material.baseColor));
+            glUniform1f(materialShininessLocation, node->material.shininess);
         }
 
         glUniform1i(12, node->ignoreLight); // Enable / disable lightning calculations
@@ -470,9 +488,7 @@ void renderNode(SceneNode* node) {
                 {
                     glm::vec4 pos = node->currentModelTransformationMatrix*glm::vec4(0.0f,0.0f,0.0f,1.0f);
                     glm::vec3 pos3 = glm::vec3(pos)/pos.w;  // Correct the length
-                    std::string uniformName = fmt::format("pointLights[{}].position", node->lightSourceID);
-                    GLint location = defaultShader->getUniformFromName(uniformName);
-                    glUniform3fv(location, 1, glm::value_ptr(pos3));
+                    glUniform3fv(pointLightPositionLocations[node->lightSourceID], 1, glm::value_ptr(pos3));
                 }
                 break;
             case SceneNode::GROUP: break;
@@ -482,12 +498,6 @@ void renderNode(SceneNode* node) {
     for(SceneNode* child : node->children) {
         renderNode(child);
     }
-
-    if (node->getIndependentChildrenSize() > 0) {
-        for (SceneNode* child : node->getIndependentChildren()) {
-            renderNode(child);
-        }
-    }
 }
 
 void renderSkybox(){
@@ -507,10 +517,88 @@ void renderSkybox(){
 
 }
 
+// Packs the matrices and colour of every ship slot into shipInstances
+// Disabled slots get a zero MVP, every vertex lands on the same point and nothing is rasterised,
+// so the slots map one to one to the instances and the chunks need no compaction
+void fillShipInstances() {
+    const ShipStore &ships = Ship::entities;
+    shipInstances.resize(ships.size());
+    auto fill = [&ships](unsigned int begin, unsigned int end) {
+        for (unsigned int slot = begin; slot < end; slot++) {
+            ShipInstance &instance = shipInstances[slot];
+            if (!ships.kinematics.isEnabled(slot)) {
+                instance.mvp = glm::mat4(0.0f);
+                continue;
+            }
+            const glm::mat4 &m = ships.model[slot];
+            instance.mvp = ships.mvp[slot];
+            for (int r = 0; r < 3; r++) instance.modelRows[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+            instance.normal = ships.normal[slot];
+            instance.color = ships.color[slot];
+        }
+    };
+    if (useMultiThread) {
+        parallelForChunks(*scheduler, 0, ships.size(), fill, 4, 256);
+    } else {
+        fill(0, ships.size());
+    }
+}
+
+// The ships share one mesh, drawn in a single instanced call
+void renderShips() {
+    const ShipStore &ships = Ship::entities;
+    if (ships.size() == 0) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, shipInstanceVBO);
+    if (shipInstancesStale || shipInstances.size() != ships.size()) {
+        fillShipInstances();
+        // Orphaned like the laser buffer, so the upload does not wait for the previous frame's draw
+        glBufferData(GL_ARRAY_BUFFER, shipInstances.size() * sizeof(ShipInstance), shipInstances.data(), GL_STREAM_DRAW);
+        shipInstancesStale = false;
+    }
+
+    glUniform1f(materialShininessLocation, Material().shininess);
+    glUniform1i(12, 0); // Ships are lit
+    glUniform1i(13, 1); // MVP, M, normal matrix and base colour from the instance attributes
+    glBindVertexArray((GLuint) Ship::vertexArrayObjectID);
+    glDrawElementsInstanced(GL_TRIANGLES, Ship::VAOIndexCount, GL_UNSIGNED_INT, nullptr, (GLsizei) shipInstances.size());
+    glUniform1i(13, 0);
+}
+
+void renderLasers() {
+    const LaserSystem &lasers = Ship::lasers;
+    if (lasers.size() == 0) return;
+
+    laserVertices.resize(lasers.size() * 6);
+    lasers.writeLineVertices(laserVertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, laserVBO);
+    // New storage every frame (orphaning), so the upload does not wait for the previous frame's draw
+    glBufferData(GL_ARRAY_BUFFER, laserVertices.size() * sizeof(float), laserVertices.data(), GL_STREAM_DRAW);
+
+    // The vertices are already in world space
+    glm::mat4 VP = projection * camera.getViewMatrix();
+    glm::mat4 M(1.0f);
+    glm::mat3 normalMatrix(1.0f);
+    glUniformMatrix4fv(3, 1, GL_FALSE, glm::value_ptr(VP));
+    glUniformMatrix4fv(4, 1, GL_FALSE, glm::value_ptr(M));
+    glUniformMatrix3fv(5, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    glUniform3f(materialBaseColorLocation, 1.0f, 0.0f, 0.0f);
+    glUniform1i(12, 1); // Lasers are not lit
+    glVertexAttrib3f(1, 1.0f, 0.0f, 0.0f); // Not a real normal, but is a safety vs 0,0,0
+
+    glBindVertexArray(laserVAO);
+    glDrawArrays(GL_LINES, 0, (GLsizei) (lasers.size() * 2));
+}
+
 void renderFrame(GLFWwindow* window) {
     int windowWidth, windowHeight;
     glfwGetWindowSize(window, &windowWidth, &windowHeight);
     glViewport(0, 0, (GLint)(windowWidth), (GLint)(windowHeight));
+    // CPU time of issuing the draw calls, the GPU runs behind and is not waited for
+    const auto renderStart = std::chrono::steady_clock::now();
     renderSkybox();
     renderNode(rootNode);
+    renderShips();
+    renderLasers();
+    renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - renderStart).count();
 }
@@ -4,7 +4,7 @@
 #include "objects/sceneGraph.hpp"
 
 void renderNode(SceneNode* node);
-void updateNodeTransformations(SceneNode* node, glm::mat4 VP, glm::mat4 transformationThusFar);
 void initGame(GLFWwindow* window, CommandLineOptions options);
+void updateSimulation(double timeDelta);
 void updateFrame(GLFWwindow* window);
 void renderFrame(GLFWwindow* window);
\ No newline at end of file
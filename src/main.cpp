@@ -7,6 +7,7 @@
 #include <GLFW/glfw3.h>
 
 // Standard headers
+#include <algorithm>
 #include <cstdlib>
 #include <arrrgh.hpp>
 
@@ -72,6 +73,13 @@ int main(int argc, const char* argb[])
 {
     arrrgh::parser parser("glowbox", "I like the name so i kept it");
     const auto& showHelp = parser.add<bool>("help", "Show this help message.", 'h', arrrgh::Optional, false);
+    const auto& workerThreads = parser.add<int>("threads", "Number of worker threads, 0 for one per hardware thread.", 't', arrrgh::Optional, 0);
+    const auto& pinThreads = parser.add<bool>("pin-threads", "Pin every worker thread to its own core.", 'p', arrrgh::Optional, false);
+    const auto& fixedTimeStep = parser.add<bool>("fixed-step", "Simulate in fixed ticks, for reproducible runs.", 'f', arrrgh::Optional, false);
+    const auto& tickRate = parser.add<int>("tick-rate", "Simulation ticks per second in fixed step mode.", 'r', arrrgh::Optional, 60);
+    const auto& escapeDirections = parser.add<int>("escape-directions", "Escape paths a ship tests when avoiding an obstacle.", 'e', arrrgh::Optional, 40);
+    const auto& seed = parser.add<int>("seed", "Seed of the ships random generators, 0 for a random seed.", 's', arrrgh::Optional, 0);
+    const auto& frameBudget = parser.add<int>("frame-budget", "Milliseconds of simulation and rendering per frame, the number of ships is adapted to fit.", 'b', arrrgh::Optional, 12);
 
     // If you want to add more program arguments, define them here,
     // but do not request their value here (they have not been parsed yet at this point).
@@ -94,6 +102,13 @@ int main(int argc, const char* argb[])
     }
 
     CommandLineOptions options;
+    options.workerThreads = (unsigned int) std::max(workerThreads.value(), 0);
+    options.pinThreads = pinThreads.value();
+    options.fixedTimeStep = fixedTimeStep.value();
+    options.tickRate = (unsigned int) std::max(tickRate.value(), 1);
+    options.seed = (unsigned int) std::max(seed.value(), 0);
+    options.escapeDirections = (unsigned int) std::max(escapeDirections.value(), 2);
+    options.frameBudgetMs = (float) std::max(frameBudget.value(), 1);
 
     // Initialise window using GLFW
     GLFWwindow* window = initialise();
@@ -0,0 +1,233 @@
+#include "flockKernel.h"
+#include "utilities/cpuFeatures.h"
+#include "utilities/random.h"
+#include <algorithm>
+#include <cmath>
+
+#ifdef GLOWBOX_X86
+    #include <immintrin.h>
+#endif
+
+// Reference implementation, also used for the tail of the SIMD kernels
+void accumulateFlockScalar(const FlockStore &f, const unsigned int* candidates, unsigned int count,
+                           const glm::vec3 &self, unsigned int selfIndex, float radius, FlockSums &sums) {
+    const FlockState &c = f.current();
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int s = candidates[i];
+        if (s == selfIndex) continue;
+        glm::vec3 pos = glm::vec3(c.posX[s], c.posY[s], c.posZ[s]);
+
+        // vec from s to self
+        glm::vec3 sepF = self - pos;
+        float l = glm::length(sepF);
+        if (l > radius) continue;
+
+        if (l == 0) {
+            sums.overlapping++;
+        } else {
+            sums.separation += sepF / l;
+        }
+        sums.velocity += glm::vec3(c.velX[s], c.velY[s], c.velZ[s]);
+        sums.position += pos;
+        sums.count++;
+    }
+}
+
+#ifdef GLOWBOX_X86
+
+// Number of set lanes in a movemask
+static unsigned int countLanes(unsigned int mask) {
+    unsigned int n = 0;
+    for (; mask != 0; mask &= mask - 1) n++;
+    return n;
+}
+
+GLOWBOX_TARGET_SSE
+static float horizontalSum(__m128 v) {
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// The distance is computed as (x*x + y*y) + z*z without fma in both SIMD kernels, the same as glm::length,
+// so the radius test picks exactly the same neighbours as the scalar kernel
+
+GLOWBOX_TARGET_SSE
+void accumulateFlockSSE(const FlockStore &f, const unsigned int* candidates, unsigned int count,
+                        const glm::vec3 &self, unsigned int selfIndex, float radius, FlockSums &sums) {
+    const FlockState &c = f.current();
+    const float* px = c.posX.data(); const float* py = c.posY.data(); const float* pz = c.posZ.data();
+    const float* vx = c.velX.data(); const float* vy = c.velY.data(); const float* vz = c.velZ.data();
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 radius4 = _mm_set1_ps(radius);
+    const __m128i self4 = _mm_set1_epi32((int) selfIndex);
+    const __m128 selfX = _mm_set1_ps(self.x), selfY = _mm_set1_ps(self.y), selfZ = _mm_set1_ps(self.z);
+    __m128 sepX = zero, sepY = zero, sepZ = zero;
+    __m128 velX = zero, velY = zero, velZ = zero;
+    __m128 posX = zero, posY = zero, posZ = zero;
+    unsigned int overlapping = 0;
+    unsigned int neighbours = 0;
+
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const unsigned int* n = candidates + i;
+        // No gather instruction before AVX2, the loads are done lane by lane
+        __m128 x = _mm_set_ps(px[n[3]], px[n[2]], px[n[1]], px[n[0]]);
+        __m128 y = _mm_set_ps(py[n[3]], py[n[2]], py[n[1]], py[n[0]]);
+        __m128 z = _mm_set_ps(pz[n[3]], pz[n[2]], pz[n[1]], pz[n[0]]);
+
+        __m128 dx = _mm_sub_ps(selfX, x);
+        __m128 dy = _mm_sub_ps(selfY, y);
+        __m128 dz = _mm_sub_ps(selfZ, z);
+        __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+
+        __m128 isSelf = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) n), self4));
+        __m128 inRange = _mm_andnot_ps(isSelf, _mm_cmple_ps(l, radius4));
+        __m128 nonZero = _mm_cmpneq_ps(l, zero);
+        __m128 inv = _mm_and_ps(_mm_div_ps(one, l), _mm_and_ps(inRange, nonZero)); // Overlapping neighbours get no direction
+        neighbours += countLanes((unsigned int) _mm_movemask_ps(inRange));
+        overlapping += countLanes((unsigned int) _mm_movemask_ps(_mm_andnot_ps(nonZero, inRange)));
+
+        sepX = _mm_add_ps(sepX, _mm_mul_ps(dx, inv));
+        sepY = _mm_add_ps(sepY, _mm_mul_ps(dy, inv));
+        sepZ = _mm_add_ps(sepZ, _mm_mul_ps(dz, inv));
+
+        velX = _mm_add_ps(velX, _mm_and_ps(inRange, _mm_set_ps(vx[n[3]], vx[n[2]], vx[n[1]], vx[n[0]])));
+        velY = _mm_add_ps(velY, _mm_and_ps(inRange, _mm_set_ps(vy[n[3]], vy[n[2]], vy[n[1]], vy[n[0]])));
+        velZ = _mm_add_ps(velZ, _mm_and_ps(inRange, _mm_set_ps(vz[n[3]], vz[n[2]], vz[n[1]], vz[n[0]])));
+
+        posX = _mm_add_ps(posX, _mm_and_ps(inRange, x));
+        posY = _mm_add_ps(posY, _mm_and_ps(inRange, y));
+        posZ = _mm_add_ps(posZ, _mm_and_ps(inRange, z));
+    }
+
+    sums.separation += glm::vec3(horizontalSum(sepX), horizontalSum(sepY), horizontalSum(sepZ));
+    sums.velocity += glm::vec3(horizontalSum(velX), horizontalSum(velY), horizontalSum(velZ));
+    sums.position += glm::vec3(horizontalSum(posX), horizontalSum(posY), horizontalSum(posZ));
+    sums.overlapping += overlapping;
+    sums.count += neighbours;
+
+    accumulateFlockScalar(f, candidates + i, count - i, self, selfIndex, radius, sums);
+}
+
+GLOWBOX_TARGET_AVX2
+static float horizontalSum(__m256 v) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    alignas(16) float lanes[4];
+    _mm_store_ps(lanes, sum);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+GLOWBOX_TARGET_AVX2
+void accumulateFlockAVX2(const FlockStore &f, const unsigned int* candidates, unsigned int count,
+                         const glm::vec3 &self, unsigned int selfIndex, float radius, FlockSums &sums) {
+    const FlockState &c = f.current();
+    const float* px = c.posX.data(); const float* py = c.posY.data(); const float* pz = c.posZ.data();
+    const float* vx = c.velX.data(); const float* vy = c.velY.data(); const float* vz = c.velZ.data();
+
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 radius8 = _mm256_set1_ps(radius);
+    const __m256i self8 = _mm256_set1_epi32((int) selfIndex);
+    const __m256 selfX = _mm256_set1_ps(self.x), selfY = _mm256_set1_ps(self.y), selfZ = _mm256_set1_ps(self.z);
+    __m256 sepX = zero, sepY = zero, sepZ = zero;
+    __m256 velX = zero, velY = zero, velZ = zero;
+    __m256 posX = zero, posY = zero, posZ = zero;
+    unsigned int overlapping = 0;
+    unsigned int neighbours = 0;
+
+    unsigned int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i n = _mm256_loadu_si256((const __m256i*) (candidates + i));
+        __m256 x = _mm256_i32gather_ps(px, n, 4);
+        __m256 y = _mm256_i32gather_ps(py, n, 4);
+        __m256 z = _mm256_i32gather_ps(pz, n, 4);
+
+        __m256 dx = _mm256_sub_ps(selfX, x);
+        __m256 dy = _mm256_sub_ps(selfY, y);
+        __m256 dz = _mm256_sub_ps(selfZ, z);
+        __m256 l = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)));
+
+        __m256 isSelf = _mm256_castsi256_ps(_mm256_cmpeq_epi32(n, self8));
+        __m256 inRange = _mm256_andnot_ps(isSelf, _mm256_cmp_ps(l, radius8, _CMP_LE_OQ));
+        __m256 nonZero = _mm256_cmp_ps(l, zero, _CMP_NEQ_OQ);
+        __m256 inv = _mm256_and_ps(_mm256_div_ps(one, l), _mm256_and_ps(inRange, nonZero)); // Overlapping neighbours get no direction
+        neighbours += countLanes((unsigned int) _mm256_movemask_ps(inRange));
+        overlapping += countLanes((unsigned int) _mm256_movemask_ps(_mm256_andnot_ps(nonZero, inRange)));
+
+        sepX = _mm256_fmadd_ps(dx, inv, sepX);
+        sepY = _mm256_fmadd_ps(dy, inv, sepY);
+        sepZ = _mm256_fmadd_ps(dz, inv, sepZ);
+
+        velX = _mm256_add_ps(velX, _mm256_and_ps(inRange, _mm256_i32gather_ps(vx, n, 4)));
+        velY = _mm256_add_ps(velY, _mm256_and_ps(inRange, _mm256_i32gather_ps(vy, n, 4)));
+        velZ = _mm256_add_ps(velZ, _mm256_and_ps(inRange, _mm256_i32gather_ps(vz, n, 4)));
+
+        posX = _mm256_add_ps(posX, _mm256_and_ps(inRange, x));
+        posY = _mm256_add_ps(posY, _mm256_and_ps(inRange, y));
+        posZ = _mm256_add_ps(posZ, _mm256_and_ps(inRange, z));
+    }
+
+    sums.separation += glm::vec3(horizontalSum(sepX), horizontalSum(sepY), horizontalSum(sepZ));
+    sums.velocity += glm::vec3(horizontalSum(velX), horizontalSum(velY), horizontalSum(velZ));
+    sums.position += glm::vec3(horizontalSum(posX), horizontalSum(posY), horizontalSum(posZ));
+    sums.overlapping += overlapping;
+    sums.count += neighbours;
+
+    accumulateFlockScalar(f, candidates + i, count - i, self, selfIndex, radius, sums);
+}
+
+#endif
+
+static bool closeEnough(const glm::vec3 &a, const glm::vec3 &b) {
+    const float tolerance = 1e-3f; // Relative, the SIMD kernels sum in a different order
+    for (int i = 0; i < 3; i++) {
+        if (std::abs(a[i] - b[i]) > tolerance * std::max(1.0f, std::abs(b[i]))) return false;
+    }
+    return true;
+}
+
+/// Run a kernel on a fixed pseudo random flock and compare it to the scalar kernel
+static bool verifyKernel(FlockKernel kernel) {
+    FlockStore flock;
+    Random random(12345);
+    auto nextFloat = [&random]() { return random.nextFloat() * 60.0f - 30.0f; };
+    std::vector<unsigned int> candidates;
+    for (unsigned int i = 0; i < 67; i++) { // Not a multiple of 8, to cover the tail
+        unsigned int slot = flock.add();
+        flock.setPosition(slot, glm::vec3(nextFloat(), nextFloat(), nextFloat()));
+        flock.setVelocity(slot, glm::vec3(nextFloat(), nextFloat(), nextFloat()));
+        candidates.push_back((i * 31) % 67); // Scattered order, like a real grid bucket
+    }
+    // Ask as slot 5, with slot 6 overlapping it and roughly half of the candidates outside the radius
+    const unsigned int selfIndex = 5;
+    flock.setPosition(6, flock.getPosition(selfIndex));
+    const glm::vec3 self = flock.getPosition(selfIndex);
+    const float radius = 30.0f;
+
+    FlockSums expected, actual;
+    accumulateFlockScalar(flock, candidates.data(), (unsigned int) candidates.size(), self, selfIndex, radius, expected);
+    kernel(flock, candidates.data(), (unsigned int) candidates.size(), self, selfIndex, radius, actual);
+
+    return actual.count == expected.count && actual.overlapping == expected.overlapping
+        && closeEnough(actual.separation, expected.separation)
+        && closeEnough(actual.velocity, expected.velocity)
+        && closeEnough(actual.position, expected.position);
+}
+
+static const SelectedKernels<FlockKernel> &selectedKernel() {
+    static const SelectedKernels<FlockKernel> selected = selectKernels<FlockKernel>("Flock",
+            GLOWBOX_SIMD_OR_SCALAR(accumulateFlockAVX2, accumulateFlockScalar),
+            GLOWBOX_SIMD_OR_SCALAR(accumulateFlockSSE, accumulateFlockScalar), accumulateFlockScalar, verifyKernel);
+    return selected;
+}
+
+FlockKernel getFlockKernel() {
+    return selectedKernel().kernels;
+}
+
+const char* getFlockKernelName() {
+    return selectedKernel().name;
+}
@@ -0,0 +1,35 @@
+#ifndef GLOWBOX_FLOCKKERNEL_H
+#define GLOWBOX_FLOCKKERNEL_H
+
+#include <glm/glm.hpp>
+#include "flockStore.h"
+#include "utilities/cpuFeatures.h"
+
+// Sums over all neighbours needed by the three flocking rules
+struct FlockSums {
+    glm::vec3 separation = glm::vec3(0.0f); // Sum of unit vectors from each neighbour towards the ship
+    glm::vec3 velocity = glm::vec3(0.0f);   // Sum of neighbour velocities
+    glm::vec3 position = glm::vec3(0.0f);   // Sum of neighbour positions
+    unsigned int count = 0;                 // Number of neighbours
+    unsigned int overlapping = 0;           // Neighbours at the exact same position, they get no separation direction
+};
+
+// Adds every candidate (flock slot) within radius of self to sums, skipping the asking ship's own slot
+// The distance test is part of the kernel, so candidates can be fed straight from the neighbour grid buckets
+typedef void (*FlockKernel)(const FlockStore &flock, const unsigned int* candidates, unsigned int count,
+                            const glm::vec3 &self, unsigned int selfIndex, float radius, FlockSums &sums);
+
+void accumulateFlockScalar(const FlockStore &flock, const unsigned int* candidates, unsigned int count,
+                           const glm::vec3 &self, unsigned int selfIndex, float radius, FlockSums &sums);
+#ifdef GLOWBOX_X86 // The SIMD kernels only exist on x86
+void accumulateFlockSSE(const FlockStore &flock, const unsigned int* candidates, unsigned int count,
+                        const glm::vec3 &self, unsigned int selfIndex, float radius, FlockSums &sums);
+void accumulateFlockAVX2(const FlockStore &flock, const unsigned int* candidates, unsigned int count,
+                         const glm::vec3 &self, unsigned int selfIndex, float radius, FlockSums &sums);
+#endif
+
+// Widest kernel supported by the cpu, selected (and verified against the scalar kernel) on first use
+FlockKernel getFlockKernel();
+const char* getFlockKernelName();
+
+#endif //GLOWBOX_FLOCKKERNEL_H
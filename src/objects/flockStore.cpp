@@ -0,0 +1,50 @@
+#include "flockStore.h"
+
+static void addSlot(FlockState &s) {
+    s.posX.push_back(0.0f); s.posY.push_back(0.0f); s.posZ.push_back(0.0f);
+    s.velX.push_back(0.0f); s.velY.push_back(0.0f); s.velZ.push_back(0.0f);
+    s.accX.push_back(0.0f); s.accY.push_back(0.0f); s.accZ.push_back(0.0f);
+}
+
+unsigned int FlockStore::add() {
+    addSlot(buffers[0]);
+    addSlot(buffers[1]);
+    flags.push_back(ENABLED);
+    return size() - 1;
+}
+
+
+static void removeSlot(FlockState &s, unsigned int index) {
+    swapRemove(s.posX, index); swapRemove(s.posY, index); swapRemove(s.posZ, index);
+    swapRemove(s.velX, index); swapRemove(s.velY, index); swapRemove(s.velZ, index);
+    swapRemove(s.accX, index); swapRemove(s.accY, index); swapRemove(s.accZ, index);
+}
+
+void FlockStore::remove(unsigned int index) {
+    removeSlot(buffers[0], index);
+    removeSlot(buffers[1], index);
+    swapRemove(flags, index);
+}
+
+void FlockStore::setPosition(unsigned int i, const glm::vec3 &v) {
+    for (FlockState &s : buffers) {
+        s.posX[i] = v.x; s.posY[i] = v.y; s.posZ[i] = v.z;
+    }
+}
+
+void FlockStore::setVelocity(unsigned int i, const glm::vec3 &v) {
+    for (FlockState &s : buffers) {
+        s.velX[i] = v.x; s.velY[i] = v.y; s.velZ[i] = v.z;
+    }
+}
+
+void FlockStore::setNext(unsigned int i, const glm::vec3 &pos, const glm::vec3 &vel, const glm::vec3 &acc) {
+    FlockState &s = buffers[front ^ 1];
+    s.posX[i] = pos.x; s.posY[i] = pos.y; s.posZ[i] = pos.z;
+    s.velX[i] = vel.x; s.velY[i] = vel.y; s.velZ[i] = vel.z;
+    s.accX[i] = acc.x; s.accY[i] = acc.y; s.accZ[i] = acc.z;
+}
+
+void FlockStore::keepCurrent(unsigned int i) {
+    setNext(i, getPosition(i), getVelocity(i), getAcceleration(i));
+}
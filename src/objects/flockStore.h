@@ -0,0 +1,67 @@
+#ifndef GLOWBOX_FLOCKSTORE_H
+#define GLOWBOX_FLOCKSTORE_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// One copy of the simulated state, one array per component
+struct FlockState {
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> velX, velY, velZ;
+    std::vector<float> accX, accY, accZ;
+};
+
+// Packed (structure of arrays) simulation state of every ship in the flock
+// The flocking rules only need position, velocity and the enabled flag of the neighbours,
+// so keeping them in separate contiguous arrays avoids pulling whole SceneNodes into the cache
+//
+// The state is double buffered: during a frame every ship reads the current state (the result of the previous frame)
+// and only writes its own slot of the next state. swap() is called once all ships are updated.
+// No ship ever sees a half updated neighbour, so the result is the same for any thread count and update order.
+class FlockStore {
+private:
+    FlockState buffers[2];
+    unsigned int front = 0;
+
+public:
+    enum Flags : unsigned char {
+        ENABLED = 1 << 0
+    };
+
+    std::vector<unsigned char> flags;
+
+    unsigned int size() const { return (unsigned int) flags.size(); }
+
+    unsigned int add();
+    void remove(unsigned int index); // Swap-remove, the last slot is moved into the freed one
+
+    // Read only state of the previous frame
+    const FlockState &current() const { return buffers[front]; }
+    void swap() { front ^= 1; }
+
+    glm::vec3 getPosition(unsigned int i) const { const FlockState &s = current(); return glm::vec3(s.posX[i], s.posY[i], s.posZ[i]); }
+    glm::vec3 getVelocity(unsigned int i) const { const FlockState &s = current(); return glm::vec3(s.velX[i], s.velY[i], s.velZ[i]); }
+    glm::vec3 getAcceleration(unsigned int i) const { const FlockState &s = current(); return glm::vec3(s.accX[i], s.accY[i], s.accZ[i]); }
+
+    // Overwrite both buffers, for spawning and moving ships outside of the simulation step
+    void setPosition(unsigned int i, const glm::vec3 &v);
+    void setVelocity(unsigned int i, const glm::vec3 &v);
+
+    // Simulation step output, only to be called by the ship owning the slot
+    void setNext(unsigned int i, const glm::vec3 &pos, const glm::vec3 &vel, const glm::vec3 &acc);
+    void keepCurrent(unsigned int i); // For ships that are not simulated this frame
+
+    bool isEnabled(unsigned int i) const { return (flags[i] & ENABLED) != 0; }
+    void setEnabled(unsigned int i, bool enabled) {
+        flags[i] = enabled ? (unsigned char) (flags[i] | ENABLED) : (unsigned char) (flags[i] & ~ENABLED);
+    }
+};
+
+// Move the last element into index and drop the last, keeps the array packed in O(1)
+template<typename T>
+void swapRemove(std::vector<T> &v, unsigned int index) {
+    v[index] = v.back();
+    v.pop_back();
+}
+
+#endif //GLOWBOX_FLOCKSTORE_H
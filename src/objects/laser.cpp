@@ -1,6 +1,58 @@
 #include "laser.h"
+#include <cassert>
 
-// Set statics fields
-unsigned int Laser::textureVaoId;
-unsigned int Laser::textureIndicesCount;
-bool Laser::textureCached = false;
+void LaserSystem::spawn(const glm::vec3 &pos, const glm::vec3 &dir, unsigned int ownerId) {
+    assert(glm::length(dir) > 0.1f);
+    assert(pos != dir); // Burnt my self too many times on this, and wondering why it aint working
+
+    const glm::vec3 d = glm::normalize(dir);
+    originX.push_back(pos.x); originY.push_back(pos.y); originZ.push_back(pos.z);
+    dirX.push_back(d.x); dirY.push_back(d.y); dirZ.push_back(d.z);
+    age.push_back(0.0f);
+    owner.push_back(ownerId);
+}
+
+void LaserSystem::update(double deltaTime) {
+    unsigned int i = 0;
+    while (i < size()) {
+        age[i] += (float) deltaTime;
+        if (age[i] < lifeTime) {
+            i++;
+            continue;
+        }
+
+        // The laser moved in from the end has not been aged yet and is handled by the next iteration
+        remove(i);
+    }
+}
+
+void LaserSystem::remove(unsigned int i) {
+    const unsigned int last = size() - 1;
+    originX[i] = originX[last]; originY[i] = originY[last]; originZ[i] = originZ[last];
+    dirX[i] = dirX[last]; dirY[i] = dirY[last]; dirZ[i] = dirZ[last];
+    age[i] = age[last];
+    owner[i] = owner[last];
+    originX.pop_back(); originY.pop_back(); originZ.pop_back();
+    dirX.pop_back(); dirY.pop_back(); dirZ.pop_back();
+    age.pop_back();
+    owner.pop_back();
+}
+
+void LaserSystem::clear() {
+    originX.clear(); originY.clear(); originZ.clear();
+    dirX.clear(); dirY.clear(); dirZ.clear();
+    age.clear();
+    owner.clear();
+}
+
+void LaserSystem::writeLineVertices(float* out) const {
+    for (unsigned int i = 0; i < size(); i++) {
+        const float travelled = velocityMagnitude * age[i];
+        const float x = originX[i] + dirX[i] * travelled;
+        const float y = originY[i] + dirY[i] * travelled;
+        const float z = originZ[i] + dirZ[i] * travelled;
+        out[0] = x; out[1] = y; out[2] = z;
+        out[3] = x + dirX[i] * length; out[4] = y + dirY[i] * length; out[5] = z + dirZ[i] * length;
+        out += 6;
+    }
+}
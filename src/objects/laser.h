@@ -1,67 +1,41 @@
 #ifndef GLOWBOX_LASER_H
 #define GLOWBOX_LASER_H
 
-#include <utilities/mesh.h>
-#include <utilities/shapes.h>
-#include <utilities/glutils.h>
-#include "sceneGraph.hpp"
+#include <glm/glm.hpp>
+#include <vector>
 
-class Laser : public SceneNode {
+// All lasers in the scene, one array per component
+// A laser only needs its spawn point, direction, age and owner, its position follows from those
+// Expired lasers are swap-removed, so the arrays stay packed and can be uploaded as they are
+class LaserSystem {
 private:
-    static unsigned int textureVaoId;
-    static unsigned int textureIndicesCount;
-    static bool textureCached;
+    std::vector<float> originX, originY, originZ;
+    std::vector<float> dirX, dirY, dirZ;
+    std::vector<float> age;
+    std::vector<unsigned int> owner; // Id of the ship that fired, it can not be hit by its own lasers
 
+public:
     const float length = 10.0f;
     const float velocityMagnitude = 160.0f;
     const float lifeTime = 2.0f; // Lifetime in seconds before despawning
-    float totalTime = 0;
-
-    glm::vec3 direction{};
-
-
-public:
-    void generateNode(glm::vec3 pos, glm::vec3 dir) {
-        // Cache texture
-        if (!textureCached) {
-            Mesh m = generateUnitLine();
-            unsigned int mVAO = generateBuffer(m);
-            Laser::textureVaoId = mVAO;
-            Laser::textureIndicesCount = m.indices.size();
-            Laser::textureCached = true;
-        }
-        this->vertexArrayObjectID = (int) Laser::textureVaoId;
-        this->VAOIndexCount = Laser::textureIndicesCount;
-        this->nodeType = SceneNode::LINE;
 
-        assert(glm::length(dir) > 0.1f);
-        assert(pos != dir); // Burnt my self too many times on this, and wondering why it aint working
+    unsigned int size() const { return (unsigned int) age.size(); }
 
-        this->position = pos;
-        this->direction = glm::normalize(dir);
-        this->rotation = calcEulerAngles(this->direction);
-        this->scale = glm::vec3(this->length);
+    void spawn(const glm::vec3 &pos, const glm::vec3 &dir, unsigned int ownerId);
+    void update(double deltaTime); // Ages every laser and removes the expired ones
+    void remove(unsigned int i); // Swap-remove, the last laser takes slot i
+    void clear();
 
-        this->material.baseColor = glm::vec3(1.0f, 0.0f, 0.0f);
-        this->ignoreLight = true;
-
-        this->setStaticMat(); // Speed up matrix calculations by setting most fields static
+    float getAge(unsigned int i) const { return age[i]; }
+    unsigned int getOwner(unsigned int i) const { return owner[i]; }
+    glm::vec3 getDirection(unsigned int i) const { return glm::vec3(dirX[i], dirY[i], dirZ[i]); }
+    // Back end of the laser, the front end is length further along the direction
+    glm::vec3 getPosition(unsigned int i) const {
+        return glm::vec3(originX[i], originY[i], originZ[i]) + getDirection(i) * (velocityMagnitude * age[i]);
     }
 
-    void update(double deltaTime) {
-        totalTime += (float) deltaTime;
-        if (totalTime < lifeTime) {
-            this->position += (float) deltaTime * (this->direction * this->velocityMagnitude);
-        } else {
-            // Ask to be deleted
-            this->enabled = false;
-        }
-
-    }
-
-    Laser(glm::vec3 pos, glm::vec3 dir) : SceneNode() {
-        generateNode(pos, dir);
-    }
+    // Both end points of every laser, 6 floats per laser, for drawing them as GL_LINES
+    void writeLineVertices(float* out) const;
 };
 
 #endif //GLOWBOX_LASER_H
@@ -14,6 +14,24 @@ struct Material {
 };
 
 
+class SceneNode;
+
+// Non owning view of a run of child pointers, so walking the children never copies them
+struct NodeSpan {
+    SceneNode* const* data = nullptr;
+    unsigned int count = 0;
+
+    NodeSpan() = default;
+    NodeSpan(SceneNode* const* data, unsigned int count) : data(data), count(count) {}
+    NodeSpan(const std::vector<SceneNode *> &nodes) : data(nodes.data()), count((unsigned int) nodes.size()) {}
+
+    unsigned int size() const { return count; }
+    bool empty() const { return count == 0; }
+    SceneNode* operator[](unsigned int i) const { return data[i]; }
+    SceneNode* const* begin() const { return data; }
+    SceneNode* const* end() const { return data + count; }
+};
+
 class SceneNode {
 private:
 
@@ -46,20 +64,13 @@ public:
     // For instance, in case of the scene graph of a human body shown in the assignment text, the "Upper Torso" node would contain the "Left Arm", "Right Arm", "Head" and "Lower Torso" nodes in its list of children.
     std::vector<SceneNode *> children;
 
-    // List of children following inheriting movement from parent, but is still a child of this node.
-    // Must be overwritten by other classes
-    virtual unsigned int getIndependentChildrenSize() {
-        return 0;
-    }
-
-    virtual std::vector<SceneNode *> getIndependentChildren() {
-        return std::vector<SceneNode *>();
-    }
+    NodeSpan getChildren() const { return NodeSpan(this->children); }
 
     // Bounding box fields
     bool hasBoundingBox = false;
     glm::vec3 boundingBoxDimension;
-    virtual BoundingBox getBoundingBox() { return genBoundingBox(this->position, this->boundingBoxDimension, this->scale); }
+    BoundingBox worldBoundingBox{}; // Cached by updateWorldBounds(), once per frame
+    const BoundingBox &getBoundingBox() const { return this->worldBoundingBox; }
     static std::vector<SceneNode *> collisionObjects; // List of all collision objects
     bool hasTinyBoundingBox = false;
     float tinyBoundingBoxSize = 10.0f;
@@ -71,9 +82,29 @@ public:
 
     glm::vec3 worldPos;
 
+    // Update worldPos and the world space bounding box from currentModelTransformationMatrix
+    // The box keeps the world scale of the node but, as with genBoundingBox, ignores its orientation
+    void updateWorldBounds() {
+        updateWorldBounds(glm::vec3(this->currentModelTransformationMatrix[3]));
+    }
+
+    // Same, with the translation of currentModelTransformationMatrix already at hand
+    void updateWorldBounds(const glm::vec3 &translation) {
+        const glm::mat4 &m = this->currentModelTransformationMatrix;
+        this->worldPos = translation;
+        if (this->hasBoundingBox) {
+            glm::vec3 worldScale(glm::length(glm::vec3(m[0])), glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2])));
+            this->worldBoundingBox = genBoundingBox(this->worldPos, this->boundingBoxDimension, worldScale);
+        }
+    }
+
     bool staticRefScaleRot = false;
     glm::mat4 refScaleRot;
 
+    // Set when the local transform changed in a way SceneTransforms can not see from the fields (refScaleRot)
+    // Changes to position, rotation, scale and referencePoint are picked up without it
+    bool transformDirty = true;
+
     void setStaticMat() {
         this->refScaleRot =
             glm::translate(this->referencePoint)
@@ -83,6 +114,7 @@ public:
             * glm::scale(this->scale)
             * glm::translate(-this->referencePoint);
         staticRefScaleRot = true;
+        transformDirty = true;
     }
 
     Material material;
@@ -120,7 +152,16 @@ public:
 
     void addChild(SceneNode *child) {
         this->children.push_back(child);
+        markStructureChanged();
+    }
+
+    // Bumped whenever a node is added or removed anywhere, so flattened copies of the graph know to rebuild
+    // Call markStructureChanged() after changing children directly
+    static unsigned int &structureVersion() {
+        static unsigned int version = 1;
+        return version;
     }
+    static void markStructureChanged() { structureVersion()++; }
 
     // Pretty prints the current values of a SceneNode instance to stdout
     void printNode() {
@@ -151,11 +192,6 @@ public:
     // AS long as the node isnt used (as with multi threading), deleting is safe
     // Cleaning should be done in a single thread or when there is no children for safety
     virtual ~SceneNode() {
-        for (SceneNode* node : this->getIndependentChildren() ) {
-                delete node;
-                node = nullptr;
-        }
-
         for (SceneNode* node : children) {
                 delete node;
                 node = nullptr;
@@ -0,0 +1,123 @@
+#include "sceneTransforms.h"
+#include "utilities/parallelFor.h"
+#include "utilities/transform.h"
+#include "utilities/matrixBatch.h"
+#include <cassert>
+
+void SceneTransforms::build(SceneNode* rootNode) {
+    struct Entry {
+        SceneNode* node;
+        int parent; // Index in entries
+        unsigned int depth;
+    };
+    std::vector<Entry> entries;
+    entries.push_back({rootNode, -1, 0});
+    unsigned int maxDepth = 0;
+    for (unsigned int i = 0; i < entries.size(); i++) {
+        const Entry e = entries[i]; // Copy, the push_backs below can move the entries
+        maxDepth = std::max(maxDepth, e.depth);
+        for (SceneNode* child : e.node->getChildren()) {
+            assert(child != e.node);
+            entries.push_back({child, (int) i, e.depth + 1});
+        }
+    }
+
+    // Counting sort by depth, stable so the order within a level follows the scene graph
+    levelStart.assign(maxDepth + 2, 0);
+    for (const Entry &e : entries) levelStart[e.depth + 1]++;
+    for (unsigned int d = 1; d < levelStart.size(); d++) levelStart[d] += levelStart[d - 1];
+
+    std::vector<unsigned int> order(entries.size());
+    std::vector<unsigned int> fill(levelStart.begin(), levelStart.end() - 1);
+    for (unsigned int i = 0; i < entries.size(); i++) order[i] = fill[entries[i].depth]++;
+
+    nodes.resize(entries.size());
+    parent.resize(entries.size());
+    for (unsigned int i = 0; i < entries.size(); i++) {
+        nodes[order[i]] = entries[i].node;
+        parent[order[i]] = entries[i].parent < 0 ? -1 : (int) order[entries[i].parent];
+        assert(parent[order[i]] < (int) levelStart[entries[i].depth]);
+    }
+    local.resize(nodes.size());
+    world.resize(nodes.size());
+    worldPos.resize(nodes.size());
+    mvp.resize(nodes.size());
+    parentWorld.resize(nodes.size());
+    for (unsigned int i = 0; i < nodes.size(); i++) parentWorld[i] = parent[i] < 0 ? &identity : &world[parent[i]];
+    lastTRS.resize(nodes.size());
+    dirty.resize(nodes.size());
+
+    root = rootNode;
+    rebuilt = true;
+    builtVersion = SceneNode::structureVersion();
+}
+
+// Rebuilds the local matrix if the node changed, returns whether its world matrix has to be redone
+bool SceneTransforms::updateLocal(unsigned int i) {
+    SceneNode* node = nodes[i];
+    LocalTRS &trs = lastTRS[i];
+    const bool localChanged = rebuilt || node->transformDirty
+            || trs.position != node->position || trs.rotation != node->rotation || trs.scale != node->scale
+            || trs.referencePoint != node->referencePoint || trs.isStatic != node->staticRefScaleRot;
+    if (localChanged) { // Otherwise only the parent may have moved, and the local matrix is still valid
+        trs = {node->position, node->rotation, node->scale, node->referencePoint, node->staticRefScaleRot};
+        node->transformDirty = false;
+        if (!node->staticRefScaleRot) {
+            local[i] = composeTRS(node->position, node->rotation, node->scale, node->referencePoint);
+        } else {
+            local[i] = node->refScaleRot; // translate(position) * refScaleRot, refScaleRot is affine
+            local[i][3] += glm::vec4(node->position, 0.0f);
+        }
+    }
+    return localChanged || (parent[i] >= 0 && dirty[parent[i]]);
+}
+
+// Calls f(runBegin, runEnd) for every run of consecutive dirty nodes in [begin, end)
+template<typename F>
+static void forEachDirtyRun(const std::vector<unsigned char> &dirty, unsigned int begin, unsigned int end, const F &f) {
+    unsigned int i = begin;
+    while (i < end) {
+        while (i < end && !dirty[i]) i++;
+        const unsigned int runBegin = i;
+        while (i < end && dirty[i]) i++;
+        if (i > runBegin) f(runBegin, i);
+    }
+}
+
+void SceneTransforms::updateChunk(unsigned int begin, unsigned int end, const glm::mat4 &VP, bool viewChanged) {
+    for (unsigned int i = begin; i < end; i++) dirty[i] = updateLocal(i);
+
+    forEachDirtyRun(dirty, begin, end, [&](unsigned int runBegin, unsigned int runEnd) {
+        multiplyAffineBatch(&parentWorld[runBegin], &local[runBegin], &world[runBegin], &worldPos[runBegin], runEnd - runBegin);
+        if (!viewChanged) multiplyMatrixBatch(VP, &world[runBegin], &mvp[runBegin], runEnd - runBegin);
+    });
+    if (viewChanged) multiplyMatrixBatch(VP, &world[begin], &mvp[begin], end - begin);
+
+    for (unsigned int i = begin; i < end; i++) {
+        SceneNode* node = nodes[i];
+        if (dirty[i]) {
+            node->currentModelTransformationMatrix = world[i]; // M
+            node->updateWorldBounds(worldPos[i]); // worldPos and the bounding box used by the collision code
+            // Transpose of the inverse of the model matrix, to fix normals inside the shader
+            node->currentNormalMatrix = normalMatrix(world[i]);
+        }
+        if (dirty[i] || viewChanged) node->currentTransformationMatrix = mvp[i]; // MVP
+    }
+}
+
+void SceneTransforms::update(SceneNode* rootNode, const glm::mat4 &VP, TaskScheduler* scheduler) {
+    if (rootNode != root || builtVersion != SceneNode::structureVersion()) build(rootNode);
+    const bool viewChanged = rebuilt || VP != lastVP;
+    lastVP = VP;
+
+    for (unsigned int d = 0; d + 1 < levelStart.size(); d++) {
+        if (scheduler != nullptr) {
+            parallelForChunks(*scheduler, levelStart[d], levelStart[d + 1], [&](unsigned int begin, unsigned int end) {
+                updateChunk(begin, end, VP, viewChanged);
+            });
+        } else {
+            updateChunk(levelStart[d], levelStart[d + 1], VP, viewChanged);
+        }
+    }
+    rebuilt = false;
+}
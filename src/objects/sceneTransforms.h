@@ -0,0 +1,54 @@
+#ifndef GLOWBOX_SCENETRANSFORMS_H
+#define GLOWBOX_SCENETRANSFORMS_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "sceneGraph.hpp"
+#include "utilities/taskScheduler.h"
+
+// The scene graph compiled into flat arrays, ordered by depth so every parent comes before its children
+// The transforms are then one linear pass per depth level instead of a recursion over the node pointers,
+// and the nodes of a level are split into parallel chunks, as they only read the (finished) level above.
+// The arrays are rebuilt when SceneNode::structureVersion() changes
+// Only nodes whose local transform changed (or whose parent moved) are recomputed, for the rest only the
+// MVP is redone, and only when the view-projection changed. A paused scene with a still camera costs almost nothing
+// The matrix products run through the batched kernels of utilities/matrixBatch.h, a run of nodes per call
+class SceneTransforms {
+private:
+    // What the local matrix was built from, compared every update to find the changed nodes
+    struct LocalTRS {
+        glm::vec3 position, rotation, scale, referencePoint;
+        bool isStatic;
+    };
+
+    SceneNode* root = nullptr;
+    unsigned int builtVersion = 0;
+    bool rebuilt = false; // Everything is recomputed on the first update after a build
+    glm::mat4 lastVP;
+    glm::mat4 identity = glm::mat4(1.0f); // Parent of the root
+
+    std::vector<SceneNode*> nodes;
+    std::vector<int> parent;              // Index in nodes, -1 for the root
+    std::vector<unsigned int> levelStart; // Level d is [levelStart[d], levelStart[d+1])
+    std::vector<glm::mat4> local;         // Relative to the parent
+    std::vector<glm::mat4> world;         // M
+    std::vector<const glm::mat4*> parentWorld; // &world[parent], the lhs of the batched products
+    std::vector<glm::vec3> worldPos;      // Translation of world, written by the same kernel
+    std::vector<glm::mat4> mvp;
+    std::vector<LocalTRS> lastTRS;
+    std::vector<unsigned char> dirty;     // World matrix changed in this update, the children follow
+
+    void build(SceneNode* rootNode);
+    bool updateLocal(unsigned int i);
+    void updateChunk(unsigned int begin, unsigned int end, const glm::mat4 &VP, bool viewChanged);
+
+public:
+    // Updates the model, MVP and normal matrices, worldPos and the bounding box of every node under rootNode
+    // The levels are split over the scheduler when one is given, done serially otherwise
+    void update(SceneNode* rootNode, const glm::mat4 &VP, TaskScheduler* scheduler);
+
+    unsigned int size() const { return (unsigned int) nodes.size(); }
+    unsigned int levels() const { return levelStart.empty() ? 0 : (unsigned int) levelStart.size() - 1; }
+};
+
+#endif //GLOWBOX_SCENETRANSFORMS_H
@@ -1,10 +1,11 @@
 #include "ship.h"
 #include "utilities/shapes.h"
 #include "utilities/glutils.h"
+#include "utilities/transform.h"
 #include "sceneGraph.hpp"
-#include <glm/gtc/random.hpp>
 #include "laser.h"
 #include <cmath>
+#include <limits>
 
 #ifndef M_PI
     #define M_PI 3.14159265358979323846
@@ -13,265 +14,376 @@
 // Sometimes i get mad at cpp
 // Static variables
 unsigned int Ship::total = 0;
-unsigned int Ship::textureVaoId;
-unsigned int Ship::textureIndicesCount;
-bool Ship::textureCached = false;
+ShipStore Ship::entities;
+unsigned int Ship::vertexArrayObjectID = 0;
+unsigned int Ship::VAOIndexCount = 0;
 std::vector<SceneNode*> Ship::attractors;
 bool Ship::disableSafetyNet = false;
-
-void Ship::generateShipNode() {
-    if (!textureCached) {
+unsigned int Ship::randomSeed = 1;
+unsigned int Ship::escapeDirectionCount = 40;
+StaggerSchedule Ship::stagger;
+SpatialGrid Ship::neighbourGrid;
+LaserSystem Ship::lasers;
+BoundingVolumeHierarchy Ship::obstacles;
+std::vector<SceneNode*> Ship::obstacleNodes;
+
+const float Ship::minVelocity = 15.0f;
+const float Ship::maxVelocity = 80.0f;
+const float Ship::perceptionRadius = 30.0f;
+const float Ship::perceptionCollisionRadius = 45.0f;
+const float Ship::maxForce = 80.0f;
+const float Ship::tinyBoundingBoxSize = 10.0f;
+
+const float Ship::weightSeparation = 1.4f;
+const float Ship::weightAlignment = 1.0f;
+const float Ship::weightCohesion = 0.7f;
+const float Ship::weightAntiCollision = 5.0f;
+const float Ship::weightAttraction = 0.2f;
+
+const float Ship::minLaserRefraction = 0.4f;
+const float Ship::laserViewDistance = 100.0f;
+
+const glm::vec3 Ship::boundingBoxDimension = glm::vec3(2,3,4)*2.0f;
+const glm::vec3 Ship::scale = glm::vec3(1.0f);
+
+unsigned int Ship::spawn() {
+    if (Ship::VAOIndexCount == 0) { // The mesh is made with the first ship, as it needs the OpenGL context
         const glm::vec3 dboxDimensions(2, 3, 4);
         Mesh m = cube(dboxDimensions, glm::vec2(dboxDimensions.x, dboxDimensions.z), true);
         //Mesh m = generateTetrahedron(glm::vec3(1.0f));
-        unsigned int mVAO = generateBuffer(m);
-        Ship::textureVaoId = mVAO;
-        Ship::textureIndicesCount = m.indices.size();
-        Ship::textureCached = true;
+        Ship::vertexArrayObjectID = generateBuffer(m);
+        Ship::VAOIndexCount = m.indices.size();
     }
-    //this->scale = glm::vec3(1.0f, 1.0f, 2.0f)*4.0f;
-    this->vertexArrayObjectID = (int) Ship::textureVaoId;
-    this->VAOIndexCount = Ship::textureIndicesCount;
-    this->nodeType = SceneNode::GEOMETRY;
-
-    this->position = glm::vec3(-4.0f, -49.0f, -100.0f);
-    this->velocity = glm::ballRand(this->maxVelocity);
 
-    this->material.baseColor = glm::vec3(0.0f, 0.0f, 1.0f);
+    const unsigned int id = ++Ship::total;
+    ShipSteering steering;
+    steering.random = Random(((uint64_t) Ship::randomSeed << 32) | id);
+    const unsigned int slot = Ship::entities.add(id, steering, glm::vec3(0.0f, 0.0f, 1.0f));
 
-    this->hasBoundingBox = true;
-    //this->boundingBoxDimension = tetrahedronDim;
-    this->boundingBoxDimension = glm::vec3(2,3,4)*2.0f;
+    Ship::setPosition(slot, glm::vec3(-4.0f, -49.0f, -100.0f));
+    Ship::entities.kinematics.setVelocity(slot, Ship::entities.steering[slot].random.ballRand(Ship::maxVelocity));
+    return slot;
+}
 
-    this->canUseBuffer = id % 2 == 0; // Create randomness
+void Ship::remove(unsigned int slot) {
+    Ship::entities.remove(slot);
 }
 
-void Ship::updateShip(double deltaTime, std::vector<Ship*> &ships) {
-    if (this->enabled) {
-        this->acceleration = glm::vec3(0.0f);
+void Ship::updateShip(unsigned int slot, double deltaTime) {
+    FlockStore &flock = Ship::entities.kinematics;
+    if (flock.isEnabled(slot)) {
+        ShipSteering &steering = Ship::entities.steering[slot];
+        const glm::vec3 position = flock.getPosition(slot);
+        glm::vec3 velocity = flock.getVelocity(slot);
+        glm::vec3 acceleration = glm::vec3(0.0f);
 
-        // Get all ships in proximity
-        const std::vector<Ship *> closeShips = this->getShipsInRadius(ships);
+        // Sum up all ships in proximity, shared by the three rules
+        const FlockSums sums = getNeighbourSums(slot);
 
         // Rule 1: Separation
-        glm::vec3 separationForce = getSeparationForce(closeShips);
+        glm::vec3 separationForce = getSeparationForce(slot, sums);
 
         // Rule 2: Alignment
-        glm::vec3 alignmentForce = getAlignmentForce(closeShips);
+        glm::vec3 alignmentForce = getAlignmentForce(slot, sums);
 
         // Rule 3: Cohesion
-        glm::vec3 cohesionForce = getCohesionForce(closeShips);
+        glm::vec3 cohesionForce = getCohesionForce(slot, sums);
 
-        this->acceleration += separationForce * this->weightSeparation;
-        this->acceleration += alignmentForce * this->weightAlignment;
-        this->acceleration += cohesionForce * this->weightCohesion;
+        acceleration += separationForce * Ship::weightSeparation;
+        acceleration += alignmentForce * Ship::weightAlignment;
+        acceleration += cohesionForce * Ship::weightCohesion;
 
         // Attaction force
         for (SceneNode* n : Ship::attractors) {
-            glm::vec3 attractionForce = getForceFromVec(n->worldPos - this->worldPos);
-            this->acceleration += attractionForce * this->weightAttraction;
+            glm::vec3 attractionForce = getForceFromVec(slot, n->worldPos - position);
+            acceleration += attractionForce * Ship::weightAttraction;
         }
 
         // Anti collision force to avoid objects
         // TODO add weighted force to treat forces based on distance (if needed)
-        Ray r = genRay(this->position, this->velocity);
-        for (SceneNode *n : SceneNode::collisionObjects) {
-            if (!n->hasBoundingBox || !n->enabled) continue;
-            if (n->hasTinyBoundingBox && glm::length(n->worldPos - this->worldPos) + this->tinyBoundingBoxSize * 1.2f < this->perceptionRadius) continue;
-
-            RayIntersection intersection = rayBoxIntersect(r, n->getBoundingBox());
-            if (intersection.intersect && intersection.distance < this->perceptionCollisionRadius) {
-                glm::vec3 antiCollisionForce = this->generateAntiCollisionForce(n);
-                this->acceleration += antiCollisionForce * this->weightAntiCollision;
-                this->material.baseColor = glm::vec3(1.0f, 1.0f, 1.0f);
-            }
+        if (runStaggered(slot, StaggerSchedule::ANTI_COLLISION)) {
+            glm::vec3 antiCollision(0.0f);
+            Ray r = genRay(position, velocity);
+            Ship::obstacles.forEachRayHit(r, Ship::perceptionCollisionRadius, [&](unsigned int i, const RayIntersection &intersection) {
+                SceneNode* n = Ship::obstacleNodes[i];
+                if (!n->enabled || intersection.distance >= Ship::perceptionCollisionRadius) return;
+                if (n->hasTinyBoundingBox && glm::length(n->worldPos - position) + Ship::tinyBoundingBoxSize * 1.2f < Ship::perceptionRadius) return;
+
+                glm::vec3 antiCollisionForce = generateAntiCollisionForce(slot, Ship::obstacles.getBox(i));
+                antiCollision += antiCollisionForce * Ship::weightAntiCollision;
+                Ship::entities.color[slot] = glm::vec3(1.0f, 1.0f, 1.0f);
+            });
+            steering.prevAntiCollision = antiCollision;
         }
+        acceleration += steering.prevAntiCollision;
 
         // Laser shooting mechanism
-        this->laserMechanism(deltaTime, ships);
+        laserMechanism(slot, deltaTime);
 
         // Check if collision with box, and move back inside, as not to just go away infinitely
         // Overwrites all other behaviors
-        if (! Ship::disableSafetyNet) { this->barrierSafetyNet(); }
+        if (! Ship::disableSafetyNet) { barrierSafetyNet(slot, acceleration); }
 
         // Calculate new velocity
-        this->velocity = this->velocity + this->acceleration * (float) deltaTime; // v = v0 + at
+        velocity = velocity + acceleration * (float) deltaTime; // v = v0 + at
         // Cap velocity over and under
-        float speed = glm::length(this->velocity);
-        glm::vec3 direction = this->velocity / speed; // Aka normalize
-        speed = glm::clamp(speed, this->minVelocity, this->maxVelocity);
-        this->velocity = speed * direction;
+        float speed = glm::length(velocity);
+        glm::vec3 direction = velocity / speed; // Aka normalize
+        speed = glm::clamp(speed, Ship::minVelocity, Ship::maxVelocity);
+        velocity = speed * direction;
+
+        // Write the ships next state, x = x0 + v*t
+        const glm::vec3 nextPosition = position + (float) deltaTime * velocity;
+        flock.setNext(slot, nextPosition, velocity, acceleration);
+
+        Ship::entities.rotation[slot] = calcEulerAngles(direction); // TODO select a component to calculate roll
+    } else {
+        flock.keepCurrent(slot);
+    }
 
-        // Update the ships position
-        this->position += (float) deltaTime * this->velocity; // x = x0 + v*t
+    //printShip(slot);
+}
 
-        // Set rotation
-        // TODO select a component to calculate roll
-        this->rotation = calcEulerAngles(direction);
+// The model matrix is built from the published state, so call it after the kinematics are swapped
+void Ship::updateTransform(unsigned int slot) {
+    ShipStore &e = Ship::entities;
+    e.model[slot] = composeTRS(e.kinematics.getPosition(slot), e.rotation[slot], Ship::scale);
+    e.normal[slot] = normalMatrix(e.model[slot]);
+}
+
+void Ship::laserMechanism(unsigned int slot, double deltaTime) {
+    // Shooting laser mechanism
+    ShipWeapon &weapon = Ship::entities.weapon[slot];
+    weapon.refraction -= (float) deltaTime;
+    if (weapon.refraction <= 0 && runStaggered(slot, StaggerSchedule::LASER_TARGETING)
+        && findLaserTarget(slot) != Ship::entities.size()) {
+        weapon.fire = true;
+        weapon.refraction = Ship::minLaserRefraction;
     }
+}
 
-    // Must be done even if the node is disabled
-    // Update lasers as they are sub-objects (todo move to graph tree directly?)
-    for (int i = (int)lasers.size() - 1; i >= 0; i--) {
-        Laser* l = lasers.at(i);
-        l->update(deltaTime);
+// First ship in front of this one, at most laserViewDistance away
+// Returns the slot of the target, or entities.size() if nothing is in the line of fire
+unsigned int Ship::findLaserTarget(unsigned int slot) {
+    float distance;
+    return Ship::castAgainstShips(getPosition(slot), glm::normalize(getVelocity(slot)), Ship::laserViewDistance,
+                                  Ship::entities.id[slot], distance);
+}
 
-        // Clean up old lasers
-        if (!l->enabled) {
-            lasers.erase(lasers.begin() + i);
-            delete l;
+// Only the grid cells along the segment are visited, instead of the whole flock
+unsigned int Ship::castAgainstShips(const glm::vec3 &origin, const glm::vec3 &direction, float length,
+                                    unsigned int ignoreId, float &hitDistance) {
+    const FlockStore &f = Ship::entities.kinematics;
+    hitDistance = std::numeric_limits<float>::infinity();
+    if (f.size() == 0) return 0;
+    const Ray r = genRay(origin, direction);
+
+    // All ships share the same bounding box dimension, so a box reaches at most halfExtent outside its ships cell
+    const glm::vec3 halfExtent = Ship::boundingBoxDimension * Ship::scale * 0.5f;
+    const float margin = std::max(std::max(halfExtent.x, halfExtent.y), halfExtent.z);
+
+    // Candidates are collected in packets of boxes, tested against the ray a packet at a time
+    BoxPacket boxes;
+    unsigned int slots[rayPacketSize];
+    alignas(32) float distance[rayPacketSize];
+    unsigned int lanes = 0;
+    unsigned int target = f.size();
+    auto testPacket = [&]() {
+        unsigned int mask = rayBoxIntersectPacket(r, boxes, lanes, distance);
+        for (unsigned int lane = 0; lane < lanes; lane++) {
+            if (!(mask >> lane & 1u)) continue;
+            // The ray reports the exit point when it starts inside a box, but the segment touches it from the start
+            bool inside = origin.x >= boxes.minX[lane] && origin.x <= boxes.maxX[lane]
+                       && origin.y >= boxes.minY[lane] && origin.y <= boxes.maxY[lane]
+                       && origin.z >= boxes.minZ[lane] && origin.z <= boxes.maxZ[lane];
+            float d = inside ? 0.0f : distance[lane];
+            if (d > length || d >= hitDistance) continue;
+            if (Ship::entities.id[slots[lane]] == ignoreId) continue;
+            hitDistance = d;
+            target = slots[lane];
         }
-    }
-    //printShip();
-}
-void Ship::laserMechanism(double deltaTime, const std::vector<Ship *> &ships) {
-    // Shooting laser mechanism
-    this->laserRefraction -= (float) deltaTime;
-    if (this->laserRefraction <= 0) {
-        Ray r = genRay(this->position, this->velocity);
-        for (SceneNode *n : ships) {
-            if (this != n) {
-                if (glm::length(n->position - this->position) < Ship::laserViewDistance) {
-                    RayIntersection intersection = rayBoxIntersect(r, n->getBoundingBox());
-                    if (intersection.intersect) {
-                        this->generateLaser();
-                        this->laserRefraction = Ship::minLaserRefraction;
-                        break;
-                    }
-                }
-            }
+        lanes = 0;
+    };
+
+    Ship::neighbourGrid.forEachBucketAlongSegment(origin, direction, length, margin, [&](const unsigned int* candidates, unsigned int count) {
+        for (unsigned int c = 0; c < count; c++) {
+            const unsigned int i = candidates[c];
+            boxes.set(lanes, genBoundingBox(f.getPosition(i), Ship::boundingBoxDimension, Ship::scale));
+            slots[lanes++] = i;
+            if (lanes == rayPacketSize) testPacket();
         }
-    }
+    });
+    if (lanes > 0) testPacket();
+    return target;
 }
 
-const int spherePoints = 40;
+// Escape paths, evenly distributed points on the front part of a sphere
+// https://stackoverflow.com/questions/9600801/evenly-distributing-n-points-on-a-sphere/44164075#44164075
+// The unit directions only depend on the count, so they are generated once, ordered from straight ahead and outwards
+struct EscapeDirections {
+    std::vector<float> x, y, z;
+};
+
 const float goldenRatio = (1.0f + std::pow(5.0f, 0.5f))/2.0f;
-const float circleFactor = 0.7f;
-glm::vec3 Ship::generateAntiCollisionForce(SceneNode *collisionObject) {
+const float circleFactor = 0.7f; // To not cover the entire sphere
+static const EscapeDirections &getEscapeDirections() {
+    static const EscapeDirections table = [] {
+        const unsigned int n = std::max(Ship::escapeDirectionCount, 2u);
+        EscapeDirections d;
+        for (unsigned int i = 0; i < n; i++) {
+            float t = (float)i/((float)(n-1))*circleFactor; // 0 -> 1*fac
+            float inclination = std::acos(1.0f - 2.0f * t);
+            float azimuth = 2.0f * (float) M_PI * goldenRatio * (float) i;
+            d.x.push_back(std::sin(inclination) * std::cos(azimuth));
+            d.y.push_back(std::sin(inclination) * std::sin(azimuth));
+            d.z.push_back(std::cos(inclination));
+        }
+        return d;
+    }();
+    return table;
+}
+
+glm::vec3 Ship::generateAntiCollisionForce(unsigned int slot, const BoundingBox &obstacle) {
     // Assumes collision is "imminent"
-    // Calculate possible escape-paths
-    // https://stackoverflow.com/questions/9600801/evenly-distributing-n-points-on-a-sphere/44164075#44164075
-
-    // To re-oriante the rays to be in the correct space
-    glm::mat3 rotationMatrix = glm::mat3(
-            glm::rotate(this->rotation.y, glm::vec3(0,1,0))
-              * glm::rotate(this->rotation.x, glm::vec3(1,0,0))
-              * glm::rotate(this->rotation.z, glm::vec3(0,0,1))
-              );
-
-    // Calculate it before, waisted resources vs readable code, or lazy evaluation instead?
-    for (int i=0; i<spherePoints; i++) {
-        float t = (float)i/((float)(spherePoints-1))*circleFactor; // 0 -> 1*fac, to not draw the entire sphere
-        float inclination = std::acos(1.0f - 2.0f * t);
-        float azimuth =  2.0f * M_PI * goldenRatio * i;
-
-        float x = std::sin(inclination) * std::cos(azimuth);
-        float y = std::sin(inclination) * std::sin(azimuth);
-        float z = std::cos(inclination);
-
-        glm::vec3 dir = glm::vec3(x, y, z);
-
-        glm::vec3 dirWithFront = rotationMatrix*dir;
-
-        Ray r = genRay(this->position, dirWithFront);
-        RayIntersection intersection = rayBoxIntersect(r, collisionObject->getBoundingBox());
-        if (!intersection.intersect || intersection.distance >= perceptionCollisionRadius) {
-            // There is a 'safe' way to avoid the collision
-            //lasers.push_back(new Laser(this->position, dirWithFront));
-            return getForceFromVec(dirWithFront);
+    const EscapeDirections &table = getEscapeDirections();
+    const unsigned int n = (unsigned int) table.x.size();
+
+    // Re-orient the directions to the ship
+    const EulerBasis basis = eulerBasis(Ship::entities.rotation[slot]);
+    const glm::vec3 &right = basis.right, &up = basis.up, &front = basis.front;
+
+    // Per thread scratch space, only allocated the first time
+    thread_local std::vector<float> dirX, dirY, dirZ, hitT;
+    dirX.resize(n); dirY.resize(n); dirZ.resize(n); hitT.resize(n);
+    for (unsigned int i = 0; i < n; i++) {
+        dirX[i] = right.x * table.x[i] + up.x * table.y[i] + front.x * table.z[i];
+        dirY[i] = right.y * table.x[i] + up.y * table.y[i] + front.y * table.z[i];
+        dirZ[i] = right.z * table.x[i] + up.z * table.y[i] + front.z * table.z[i];
+    }
+
+    // Test every escape path at once, then take the first 'safe' one
+    rayBoxIntersectBatch(getPosition(slot), dirX.data(), dirY.data(), dirZ.data(), n, obstacle, hitT.data());
+    for (unsigned int i = 0; i < n; i++) {
+        if (hitT[i] >= perceptionCollisionRadius) {
+            return getForceFromVec(slot, glm::vec3(dirX[i], dirY[i], dirZ[i]));
         }
     }
-    return getForceFromVec(this->velocity * -1.0f);
+    return getForceFromVec(slot, getVelocity(slot) * -1.0f);
 }
 
 
 /// Calculate the separation force with a (linear) inverse proportional factor
-/// @param closeShips all ships within the perceptionRadius
+/// @param sums neighbour sums of all ships within the perceptionRadius
 /// @return force for steering away from all neighbours
-glm::vec3 Ship::getSeparationForce(const std::vector<Ship*> &closeShips) {
-    if (closeShips.empty()) return glm::vec3(0.0f);
+glm::vec3 Ship::getSeparationForce(unsigned int slot, const FlockSums &sums) {
+    if (sums.count == 0) return glm::vec3(0.0f);
 
     // Sum of forces, between 0 and 1
-    glm::vec3 separationForce = glm::vec3(0.0f);
-    for (const Ship* s : closeShips) {
-        // vec from s to this
-        glm::vec3 sepF = this->position - s->position;
-        float l = glm::length(sepF);
-
-        if (l == 0) { // if they get inside of each other, use random vector
-            separationForce += glm::ballRand(2.0f);
-        } else {
-            separationForce += sepF / l;
-        }
+    glm::vec3 separationForce = sums.separation;
+    for (unsigned int i = 0; i < sums.overlapping; i++) { // if they get inside of each other, use random vector
+        separationForce += Ship::entities.steering[slot].random.ballRand(2.0f);
     }
-    return getForceFromVec(separationForce, false);
+    return getForceFromVec(slot, separationForce, false);
 }
 
 /// Calculate the alignment force
-/// @param closeShips all ships within the perceptionRadius
+/// @param sums neighbour sums of all ships within the perceptionRadius
 /// @return force for steering along the average velocity
-glm::vec3 Ship::getAlignmentForce(const std::vector<Ship*> &closeShips) {
-    if (closeShips.empty()) return glm::vec3(0.0f);
+glm::vec3 Ship::getAlignmentForce(unsigned int slot, const FlockSums &sums) {
+    if (sums.count == 0) return glm::vec3(0.0f);
 
-    glm::vec3 averageVelocity = glm::vec3(0.0f);
-    for (const Ship* s : closeShips) {
-        averageVelocity += s->velocity;
-    }
-    //averageVelocity /= closeShips.size(); // Not needed, but nice for visualization of the math
-    return getForceFromVec(averageVelocity);
+    glm::vec3 averageVelocity = sums.velocity;
+    //averageVelocity /= sums.count; // Not needed, but nice for visualization of the math
+    return getForceFromVec(slot, averageVelocity);
 }
 
 /// Calculate the cohesion force
-/// @param closeShips all ships within the perceptionRadius
+/// @param sums neighbour sums of all ships within the perceptionRadius
 /// @return force for steering towards the average position
-glm::vec3 Ship::getCohesionForce(const std::vector<Ship*> &closeShips) { // TODO weighted?
-    if (closeShips.empty()) return glm::vec3(0.0f);
+glm::vec3 Ship::getCohesionForce(unsigned int slot, const FlockSums &sums) { // TODO weighted?
+    if (sums.count == 0) return glm::vec3(0.0f);
 
-    glm::vec3 centerOfFlock = glm::vec3(0.0f);
-    for (Ship* s : closeShips) {
-        centerOfFlock += s->position;
-    }
-    centerOfFlock /= closeShips.size();
+    glm::vec3 centerOfFlock = sums.position / (float) sums.count;
 
     // Vector from ship to center of flock
-    glm::vec3 shipToFlock = centerOfFlock - this->position;
-    return getForceFromVec(shipToFlock);
+    glm::vec3 shipToFlock = centerOfFlock - getPosition(slot);
+    return getForceFromVec(slot, shipToFlock);
 }
 
 /// Transform steering-direction to a desired velocity vector, which we can use as a force
 /// @param vec vector in the desired location
 /// @param vecDiff to subtract the currents ship velocity to get the desired force, used by separation-force
 /// @return steering force
-glm::vec3 Ship::getForceFromVec(const glm::vec3 &vec, bool vecDiff) { // vecDiff is by default true
+glm::vec3 Ship::getForceFromVec(unsigned int slot, const glm::vec3 &vec, bool vecDiff) { // vecDiff is by default true
     if (glm::length(vec) < 0.2f) { // Ignore super tiny vectors and avoid div by 0 assumes allowed maxForce > val
         return vec;
     }
-    glm::vec3 desiredVector = glm::normalize(vec) * this->maxVelocity;
-    if (vecDiff) desiredVector -= this->velocity;
-    return limitVector(desiredVector, this->maxForce);
+    glm::vec3 desiredVector = glm::normalize(vec) * Ship::maxVelocity;
+    if (vecDiff) desiredVector -= getVelocity(slot);
+    return limitVector(desiredVector, Ship::maxForce);
 }
 
-std::vector<Ship*> Ship::getShipsInRadius(std::vector<Ship*> &ships) {
-    // Half sampling to cpu load (if turned on)
-    if (this->allowCpuLoadReduction && this->canUseBuffer) {
-        this->canUseBuffer = false;
-        return this->prevCloseShips;
-    }
-    std::vector<Ship*> returnList;
-    for (Ship* ship2 : ships) {
-        if (this != ship2 && ship2->enabled) {
-            if (glm::length(this->position - ship2->position) <= this->perceptionRadius) {
-                returnList.push_back(ship2);
-            }
-        }
+/// Accumulate the flocking sums of all enabled ships within the perceptionRadius
+/// The grid buckets are fed directly to the flock kernel, so no neighbour list is built
+FlockSums Ship::getNeighbourSums(unsigned int slot) {
+    ShipSteering &steering = Ship::entities.steering[slot];
+    if (!runStaggered(slot, StaggerSchedule::NEIGHBOURS)) return steering.prevNeighbourSums;
+    const FlockKernel kernel = getFlockKernel();
+    const glm::vec3 position = getPosition(slot);
+    FlockSums sums;
+    Ship::neighbourGrid.forEachBucketInRadius(position, Ship::perceptionRadius, [&](const unsigned int* candidates, unsigned int count) {
+        kernel(Ship::entities.kinematics, candidates, count, position, slot, Ship::perceptionRadius, sums);
+    });
+    steering.prevNeighbourSums = sums;
+    return sums;
+}
+
+/// Whether a staggered task is due for this ship in the current step
+/// A task always runs the first time (or after the ship is re-enabled), so there is a result to reuse
+bool Ship::runStaggered(unsigned int slot, StaggerSchedule::Task task) {
+    unsigned int &results = Ship::entities.steering[slot].staggerResults;
+    const unsigned int bit = 1u << task;
+    if ((results & bit) && !Ship::stagger.isDue(task, Ship::entities.id[slot])) return false;
+    results |= bit;
+    return true;
+}
+
+/// Rebuild the neighbour grid from the current flock positions, must be called once per frame before updating the ships
+/// Disabled ships are left out of the grid
+/// The cell size equals the perception radius, so a radius query only has to visit the 3x3x3 surrounding cells
+void Ship::updateNeighbourGrid() {
+    const FlockStore &f = Ship::entities.kinematics;
+    if (f.size() == 0) return;
+    const FlockState &s = f.current();
+    Ship::neighbourGrid.rebuild(s.posX.data(), s.posY.data(), s.posZ.data(), f.size(), Ship::perceptionRadius,
+                                f.flags.data(), FlockStore::ENABLED);
+}
+
+/// Refit the obstacle hierarchy to the current bounding boxes, must be called once per frame before updating the ships
+/// The hierarchy is only rebuilt when collision objects are added or removed
+void Ship::updateObstacles() {
+    static std::vector<SceneNode*> nodes; // Scratch, reused every frame
+    static std::vector<BoundingBox> boxes;
+    nodes.clear();
+    boxes.clear();
+    for (SceneNode* n : SceneNode::collisionObjects) {
+        if (!n->hasBoundingBox) continue;
+        nodes.push_back(n);
+        boxes.push_back(n->getBoundingBox());
     }
-    if (this->allowCpuLoadReduction) {
-        this->prevCloseShips = returnList;
-        this->canUseBuffer = true;
+
+    if (nodes == Ship::obstacleNodes) {
+        Ship::obstacles.refit(boxes);
+    } else {
+        Ship::obstacleNodes = nodes;
+        Ship::obstacles.build(boxes);
     }
-    return returnList;
 }
 
+void Ship::setEnabled(unsigned int slot, bool enable) {
+    Ship::entities.kinematics.setEnabled(slot, enable);
+    Ship::entities.steering[slot].staggerResults = 0; // Results from before it was disabled are stale
+}
 
 //  x=0  => boxNode.x = 0
 //  z box dim: 90/2 -80 = -35  -> -125,
@@ -279,27 +391,58 @@ std::vector<Ship*> Ship::getShipsInRadius(std::vector<Ship*> &ships) {
 const glm::vec3 boxOffset = glm::vec3(0, 0, 0);
 //const glm::vec3 boxDimensions = glm::vec3(90, 90, 90)*2.0f;
 const glm::vec3 boxDimensions(249.0f, 249.0f, 249.0f);
-void Ship::barrierSafetyNet() {
-    float x = this->position.x;
-    float y = this->position.y;
-    float z = this->position.z;
+void Ship::barrierSafetyNet(unsigned int slot, glm::vec3 &acceleration) {
+    const glm::vec3 position = getPosition(slot);
+    float x = position.x;
+    float y = position.y;
+    float z = position.z;
 
-    float mf = this->maxForce;
+    float mf = Ship::maxForce;
 
     // -90 -> 90
-    if (x > boxDimensions.x / 2 + boxOffset.x) this->acceleration.x = -mf;
-    if (x < -boxDimensions.x / 2 + boxOffset.x) this->acceleration.x = mf;
+    if (x > boxDimensions.x / 2 + boxOffset.x) acceleration.x = -mf;
+    if (x < -boxDimensions.x / 2 + boxOffset.x) acceleration.x = mf;
 
-    if (y > boxDimensions.y / 2 + boxOffset.y) this->acceleration.y = -mf;
-    if (y < -boxDimensions.y / 2 + boxOffset.y) this->acceleration.y = mf;
+    if (y > boxDimensions.y / 2 + boxOffset.y) acceleration.y = -mf;
+    if (y < -boxDimensions.y / 2 + boxOffset.y) acceleration.y = mf;
 
     // -35 -> -125
-    if (z > boxDimensions.z / 2 + boxOffset.z) this->acceleration.z = -mf;
-    if (z < -boxDimensions.z / 2 + boxOffset.z) this->acceleration.z = mf;
+    if (z > boxDimensions.z / 2 + boxOffset.z) acceleration.z = -mf;
+    if (z < -boxDimensions.z / 2 + boxOffset.z) acceleration.z = mf;
+}
+
+void Ship::generateLaser(unsigned int slot) {
+    Ship::lasers.spawn(getPosition(slot), getVelocity(slot), Ship::entities.id[slot]);
 }
 
-void Ship::generateLaser() {
-    this->lasers.push_back(new Laser(this->position, glm::normalize(this->velocity)));
+void Ship::updateLasers(double deltaTime) {
+    for (unsigned int slot = 0; slot < Ship::entities.size(); slot++) {
+        ShipWeapon &weapon = Ship::entities.weapon[slot];
+        if (weapon.fire) {
+            generateLaser(slot);
+            weapon.fire = false;
+        }
+    }
+    LaserSystem &l = Ship::lasers;
+    l.update(deltaTime);
+
+    // Hits, each laser is swept from where it was to where it is now, so fast lasers can not skip over a ship
+    // One grid query per laser, so the cost grows with lasers plus ships instead of lasers times ships
+    const float maxSweep = l.velocityMagnitude * (float) deltaTime;
+    unsigned int i = 0;
+    while (i < l.size()) {
+        const glm::vec3 direction = l.getDirection(i);
+        const float sweep = std::min(maxSweep, l.velocityMagnitude * l.getAge(i)); // New lasers start at the ship
+        const glm::vec3 start = l.getPosition(i) - direction * sweep;
+        float distance;
+        unsigned int target = Ship::castAgainstShips(start, direction, sweep + l.length, l.getOwner(i), distance);
+        if (target != Ship::entities.size()) {
+            Ship::entities.weapon[target].hits++;
+            l.remove(i); // The last laser is moved into slot i, test it next
+        } else {
+            i++;
+        }
+    }
 }
 
 glm::vec3 limitVector(const glm::vec3 &vec, float maxLength) {
@@ -310,16 +453,19 @@ glm::vec3 limitVector(const glm::vec3 &vec, float maxLength) {
     return length * direction;
 }
 
-void Ship::printShip() {
+void Ship::printShip(unsigned int slot) {
+    const glm::vec3 position = getPosition(slot);
+    const glm::vec3 velocity = getVelocity(slot);
+    const glm::vec3 acceleration = Ship::entities.kinematics.getAcceleration(slot);
     printf(
             "Ship %i {\n"
             "    Location: (%f, %f, %f)\n"
             "    Velocity: (%f, %f, %f) - %f\n"
             "    Acceleration: (%f, %f, %f) - %f\n"
             "}\n",
-            this->id,
-            this->position.x, this->position.y, this->position.z,
-            this->velocity.x, this->velocity.y, this->velocity.z, glm::length(this->velocity),
-            this->acceleration.x, this->acceleration.y, this->acceleration.z, glm::length(this->acceleration)
+            Ship::entities.id[slot],
+            position.x, position.y, position.z,
+            velocity.x, velocity.y, velocity.z, glm::length(velocity),
+            acceleration.x, acceleration.y, acceleration.z, glm::length(acceleration)
             );
 }
\ No newline at end of file
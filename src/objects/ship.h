@@ -1,75 +1,97 @@
 #pragma once
 
-#include <memory>
 #include "sceneGraph.hpp"
 #include "laser.h"
+#include "shipStore.h"
+#include "flockKernel.h"
+#include "utilities/spatialGrid.h"
+#include "utilities/boundingVolumeHierarchy.h"
+#include "utilities/staggerSchedule.h"
 #include <algorithm>
 
-class Ship : public SceneNode{
-    //typedef std::shared_ptr<Laser> LaserPtr; // Laser smart pointer alias
+// Ships are entities, a ship is only its slot in Ship::entities (one dense array per component)
+// This class holds the systems working on those arrays and the state they share, it is never instantiated
+class Ship {
 private:
     static unsigned int total;
-    unsigned int id;
-
-    static unsigned int textureVaoId;
-    static unsigned int textureIndicesCount;
-    static bool textureCached;
-
-    float minVelocity = 15.0f;
-    float maxVelocity = 80.0f;
-    float perceptionRadius = 30.0f;
-    float perceptionCollisionRadius = 45.0f;
-    float maxForce = 80.0f;
-
-    float weightSeparation = 1.4f;
-    float weightAlignment = 1.0f;
-    float weightCohesion = 0.7f;
-    float weightAntiCollision = 5.0f;
-    float weightAttraction = 0.2f;
-
-    std::vector<Ship*> getShipsInRadius(std::vector<Ship*> &ships);
-    glm::vec3 getSeparationForce(const std::vector<Ship*> &closeShips);
-    glm::vec3 getAlignmentForce(const std::vector<Ship*> &closeShips);
-    glm::vec3 getCohesionForce(const std::vector<Ship*> &closeShips);
-    glm::vec3 generateAntiCollisionForce(SceneNode* collisionObject);
-    glm::vec3 getForceFromVec(const glm::vec3 &vec, bool vecDiff=true);
-    void barrierSafetyNet();
-    void laserMechanism(double deltaTime, const std::vector<Ship *> &ships);
-
-
-    const float minLaserRefraction = 0.4f; // How often (min) can the ship shoot in seconds
-    const float laserViewDistance = 100.0f;
-    float laserRefraction = std::min(minLaserRefraction*5.0f, 5.0f); // Delay first laser
-
-    bool allowCpuLoadReduction = true; // Trades off performance vs correctness
-    std::vector<Ship*> prevCloseShips;
-    bool canUseBuffer;
+
+    static const float minVelocity;
+    static const float maxVelocity;
+    static const float perceptionRadius;
+    static const float perceptionCollisionRadius;
+    static const float maxForce;
+    static const float tinyBoundingBoxSize;
+
+    static const float weightSeparation;
+    static const float weightAlignment;
+    static const float weightCohesion;
+    static const float weightAntiCollision;
+    static const float weightAttraction;
+
+    static const float minLaserRefraction; // How often (min) can the ship shoot in seconds
+    static const float laserViewDistance;
+
+    static FlockSums getNeighbourSums(unsigned int slot);
+    static glm::vec3 getSeparationForce(unsigned int slot, const FlockSums &sums);
+    static glm::vec3 getAlignmentForce(unsigned int slot, const FlockSums &sums);
+    static glm::vec3 getCohesionForce(unsigned int slot, const FlockSums &sums);
+    static glm::vec3 generateAntiCollisionForce(unsigned int slot, const BoundingBox &obstacle);
+    static glm::vec3 getForceFromVec(unsigned int slot, const glm::vec3 &vec, bool vecDiff=true);
+    static void barrierSafetyNet(unsigned int slot, glm::vec3 &acceleration);
+    static void laserMechanism(unsigned int slot, double deltaTime);
+    static unsigned int findLaserTarget(unsigned int slot);
+    static bool runStaggered(unsigned int slot, StaggerSchedule::Task task);
 
 public:
-    std::vector<Laser*> lasers;
+    Ship() = delete;
+
+    static ShipStore entities;
+
+    // Collider and mesh, shared by every ship
+    static const glm::vec3 boundingBoxDimension;
+    static const glm::vec3 scale;
+    static unsigned int vertexArrayObjectID;
+    static unsigned int VAOIndexCount;
 
-    glm::vec3 acceleration = glm::vec3(1.0f, 1.0f, 1.0f);
-    glm::vec3 velocity = glm::vec3(1.0f, 1.0f, 1.0f);
+    static unsigned int spawn(); // Returns the slot of the new ship
+    static void remove(unsigned int slot); // The last ship is moved into the slot
+    static void updateShip(unsigned int slot, double deltaTime);
+    static void updateTransform(unsigned int slot); // Model and normal matrix of the ship, from its kinematics
+    static void generateLaser(unsigned int slot);
 
-    void generateShipNode();
-    void updateShip(double deltaTime, std::vector<Ship*> &ships);
-    void generateLaser();
+    // Nearest ship whose bounding box the segment (unit direction) touches, ignoring the ship with id ignoreId
+    // Returns its slot, or entities.size() on a miss. hitDistance is 0 if the segment starts inside the box
+    static unsigned int castAgainstShips(const glm::vec3 &origin, const glm::vec3 &direction, float length,
+                                         unsigned int ignoreId, float &hitDistance);
 
-    unsigned int getIndependentChildrenSize() override { return lasers.size(); }
-    // TODO research if there is a "cheaper" way
-    // Alternatively, have a list of casted pointers, manage both lists OR castback
-    std::vector<SceneNode*> getIndependentChildren() override {
-        return std::vector<SceneNode*>(lasers.begin(), lasers.end());
-    }
+    static glm::vec3 getPosition(unsigned int slot) { return Ship::entities.kinematics.getPosition(slot); }
+    static glm::vec3 getVelocity(unsigned int slot) { return Ship::entities.kinematics.getVelocity(slot); }
+    static void setPosition(unsigned int slot, const glm::vec3 &pos) { Ship::entities.kinematics.setPosition(slot, pos); }
+    static void setEnabled(unsigned int slot, bool enable);
 
     static std::vector<SceneNode*> attractors;
     static bool disableSafetyNet;
 
-    void printShip();
+    static unsigned int escapeDirectionCount; // Escape paths tested when avoiding an obstacle, set before the first update
+    static unsigned int randomSeed; // Set before creating ships, same seed and ship order gives the same flock
+    static StaggerSchedule stagger; // How often the expensive per ship work is redone, advanced once per step
+
+    // Neighbour lookup, indexed by slot
+    static SpatialGrid neighbourGrid;
+    static void updateNeighbourGrid();
+
+    // Obstacle lookup, built from SceneNode::collisionObjects (with a bounding box), indexed like obstacleNodes
+    static BoundingVolumeHierarchy obstacles;
+    static std::vector<SceneNode*> obstacleNodes;
+    static void updateObstacles();
+
+    // Lasers of every ship, rendered in one draw call
+    static LaserSystem lasers;
+    // Spawn the lasers requested this frame (in slot order), age all lasers and resolve their hits
+    // Call after all ships are updated, before the kinematics are swapped
+    static void updateLasers(double deltaTime);
 
-    Ship() : SceneNode(), id(++total) {
-        generateShipNode();
-    }
+    static void printShip(unsigned int slot);
 };
 
-glm::vec3 limitVector(const glm::vec3 &vec, float maxLength);
\ No newline at end of file
+glm::vec3 limitVector(const glm::vec3 &vec, float maxLength);
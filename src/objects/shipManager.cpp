@@ -1,138 +1,146 @@
 #include "objects/shipManager.h"
+#include "utilities/parallelFor.h"
+#include "utilities/pidController.h"
+#include "utilities/matrixBatch.h"
 #include <algorithm>
 #include <cmath>
 
 const unsigned int minBots = 20; // if you cant handle this. Idk dude
-const unsigned int maxBots = 2000; // A max, as what if there are too many
-
-const unsigned int targetFps = 40; // Target should be 60 fps
-const unsigned int allowedFpsDelta = 10; // Try to stay inside 60+-10 fps
-
-float weightedAverageFps = 0; // Should hovered around targetFps
-
-double totalTimeSinceLastUpdate = 0;
-const double allowedUpdateRate = 5.0f; // How often is it allowed to update the number of bots
-
-bool newlyUpdate = false;
-float preUpdateFps = 0;
-int deltaBots = 10;
+const unsigned int maxBots = 10000; // A max, as what if there are too many
+
+// Adaptive ship count
+// The frame time grows about linearly with the number of ships, so the controller works on the log of the ship count:
+// the error log(budget / measured time) is then the (log) distance to the fitting count, on any machine
+float frameBudgetMs = 12.0f; // Simulation and render time per frame to aim for
+const double controlInterval = 0.25; // Seconds of frames averaged per controller update
+const float maxLogError = 0.5f; // A single hitch (loading, dragging the window) removes at most a few tens of percent of the ships
+PidController shipCountController(0.1f, 1.0f, 0.01f, 0.0f, 0.0f); // Output is log(ships / referenceBots)
+unsigned int referenceBots = 0; // Ship count at output 0, taken from the first update
+double timeSinceControl = 0;
+double frameMsSum = 0;
+unsigned int frameMsCount = 0;
+
+const unsigned int defaultStaggerLevel = 2;
+const unsigned int maxStaggerLevel = 8; // Neighbours are redone at least every 8th frame
+
+void updateShips(double deltaTime, TaskScheduler* scheduler) {
+    Ship::stagger.advance();
+
+    // Index the bots and the obstacles once per frame, used by all the neighbour and collision queries
+    Ship::updateNeighbourGrid();
+    Ship::updateObstacles();
+
+    const unsigned int ships = Ship::entities.size();
+    if (scheduler != nullptr) {
+        parallelFor(*scheduler, 0, ships, [&](unsigned int slot) {
+            Ship::updateShip(slot, deltaTime);
+        });
+    } else {
+        for (unsigned int slot = 0; slot < ships; slot++) {
+            Ship::updateShip(slot, deltaTime);
+        }
+    }
 
-bool dipDetected = false;
-const int maxChangeInBots = 100.0f; // Not allowed to remove or add more than 20 bots
-const float fallbackBotsPerFps = 1.0f;
-float botsPerFps = 2.0f; // How much each new bot impacted the fps, example 2 => 2 reduction in fps per bot
+    // Fired lasers are spawned here instead of by the ships, so the update needs no locking
+    Ship::updateLasers(deltaTime);
 
+    // Every ship has written its next state, publish it for the next frame
+    Ship::entities.kinematics.swap();
+}
 
-int calculateAmountAdaptiveUpdateAmountBots(float &currentFps, double &time) {
-    // Arbitrary weighted fps
-    weightedAverageFps = (weightedAverageFps + currentFps) / 2;
+void updateShipTransforms(TaskScheduler* scheduler) {
+    const unsigned int ships = Ship::entities.size();
+    if (scheduler != nullptr) {
+        parallelFor(*scheduler, 0, ships, [](unsigned int slot) {
+            Ship::updateTransform(slot);
+        });
+    } else {
+        for (unsigned int slot = 0; slot < ships; slot++) {
+            Ship::updateTransform(slot);
+        }
+    }
+}
 
-    if(currentFps < (float) (targetFps - allowedFpsDelta)) {
-        dipDetected = true;
+void updateShipMVPs(const glm::mat4 &VP, TaskScheduler* scheduler) {
+    ShipStore &e = Ship::entities;
+    if (scheduler != nullptr) {
+        parallelForChunks(*scheduler, 0, e.size(), [&](unsigned int begin, unsigned int end) {
+            multiplyMatrixBatch(VP, &e.model[begin], &e.mvp[begin], end - begin);
+        }, 4, 256);
+    } else if (e.size() > 0) {
+        multiplyMatrixBatch(VP, e.model.data(), e.mvp.data(), e.size());
     }
+}
 
-    totalTimeSinceLastUpdate += time;
-
-    if (totalTimeSinceLastUpdate > allowedUpdateRate) {
-        totalTimeSinceLastUpdate = 0;
-
-        if (newlyUpdate) {
-            float diffFps = preUpdateFps - weightedAverageFps; // Estimated change (dip) in fps due to spawning
-            if (std::abs(diffFps) < fallbackBotsPerFps) { // Insignificant fps, default in case of instability
-                printf("insig %f\n", diffFps);
-                botsPerFps = fallbackBotsPerFps;
-            } else {
-                botsPerFps = (float) deltaBots / diffFps;
-            }
-            botsPerFps = std::abs(botsPerFps); // Inpact based on over or under tresh
-            newlyUpdate = false;
-            printf("bpfps %f\n", botsPerFps);
-        }
+void setFrameBudget(float ms) {
+    frameBudgetMs = std::max(ms, 1.0f);
+}
 
-        if (weightedAverageFps < (float) (targetFps - allowedFpsDelta) // Fps is under or over threshold
-            || weightedAverageFps > (float) (targetFps + 2*allowedFpsDelta)) { // 2x max threshold to keep it sable
-            deltaBots = calculateBotDiff(weightedAverageFps, targetFps, botsPerFps);
-            preUpdateFps = weightedAverageFps;
-            newlyUpdate = true;
-            return deltaBots;
-        }
+// New ships are appended, so adding is O(1) per ship
+// They start on top of the existing ships in turn, a large batch spawned in one spot would be one huge neighbourhood
+void addBots(unsigned int count) {
+    const unsigned int existing = Ship::entities.size();
+    for (unsigned int i = 0; i < count; i++) {
+        const unsigned int slot = Ship::spawn();
+        if (existing > 0) Ship::setPosition(slot, Ship::getPosition(i % existing));
     }
-    return 0; // In the event that no change in bots
 }
 
-int calculateBotDiff(float current, unsigned int target, float bpfps) {
-    if (std::abs(bpfps) < 0.0001f) {
-        bpfps = 0.01f * (float) sgn(bpfps);
+// Ships are taken from the back, so no ship is moved and removing is O(1) per ship as well
+void removeBots(unsigned int count) {
+    count = std::min(count, Ship::entities.size());
+    for (unsigned int i = 0; i < count; i++) {
+        Ship::remove(Ship::entities.size() - 1);
     }
-    int estimatedBots = (int) truncf(bpfps * (current - (float) target));
-    if (dipDetected && estimatedBots > 0) {
-        dipDetected = false;
-        estimatedBots = -10; // Force it to remove bots in there is a dip detected and we are around target fps
-    }
-    estimatedBots = clamp(estimatedBots, -maxChangeInBots, maxChangeInBots); // As bpfps is not a linear relation, clamp it
-    return estimatedBots;
 }
 
-template<typename T>
-T clamp(const T &n, const T &lower, const T &upper) {
-    return std::max(lower, std::min(n, upper));
+// Second lever of the adaptive controller, for when the ship count is stuck at a limit:
+// spread the expensive ship work over more frames if even minBots is over budget,
+// and go back towards doing it every frame once there is time to spare
+void updateStaggerPeriods(float frameMs, unsigned int ships) {
+    unsigned int level = Ship::stagger.getPeriod(StaggerSchedule::NEIGHBOURS);
+    if (ships <= minBots && frameMs > frameBudgetMs && level < maxStaggerLevel) {
+        level++;
+    } else if (frameMs < frameBudgetMs * 0.8f && (level > defaultStaggerLevel || (ships >= maxBots && level > 1))) {
+        level--;
+    } else {
+        return;
+    }
+    // Obstacle avoidance is what keeps the ships out of the sun, so it is thinned out at half the rate
+    Ship::stagger.setPeriod(StaggerSchedule::NEIGHBOURS, level);
+    Ship::stagger.setPeriod(StaggerSchedule::LASER_TARGETING, level);
+    Ship::stagger.setPeriod(StaggerSchedule::ANTI_COLLISION, (level + 1) / 2);
 }
 
-template<typename T>
-int sgn(T val) {
-    return (T(0) <= val) - (val < T(0));
-}
+// Adaptive amount of bots, to fit the frame budget
+void updateAmountBots(float frameMs, double time) {
+    frameMsSum += frameMs;
+    frameMsCount++;
+    timeSinceControl += time;
+    if (timeSinceControl < controlInterval) return;
+
+    const float measuredMs = (float) (frameMsSum / frameMsCount);
+    const float dt = (float) timeSinceControl;
+    timeSinceControl = 0;
+    frameMsSum = 0;
+    frameMsCount = 0;
+
+    const unsigned int bots = Ship::entities.size();
+    if (referenceBots == 0) {
+        referenceBots = std::max(bots, minBots);
+        shipCountController.setOutputLimits(std::log((float) minBots / referenceBots), std::log((float) maxBots / referenceBots));
+        shipCountController.reset(std::log((float) std::max(bots, minBots) / referenceBots));
+    }
 
-// Adaptive update bots based on fps
-void updateAmountBots(std::vector <Ship*> &bots, SceneNode* botsNode, float &currentFps, double &time) {
-    // Only update bots if inside limits
-    if (bots.size() > minBots && bots.size() < maxBots) {
-        int deltaBots = calculateAmountAdaptiveUpdateAmountBots(currentFps, time);
-        if (bots.size() + deltaBots < minBots) deltaBots = bots.size() - minBots;
-
-        if (deltaBots > 0) { // Add bots
-            // Activate old disabled bots
-            for (Ship *s : bots) {
-                if (deltaBots == 0) break;
-                if (!s->enabled) {
-                    s->enabled = true;
-                    deltaBots--;
-                }
-            }
-            // Add new bots if needed
-            for (int i=0; i<deltaBots; i++) {
-                Ship *ship = new Ship();
-                bots.push_back(ship);
-                botsNode->addChild(ship); // Add it to be rendered
-                ship->position = bots.at(0)->position;
-            }
-            printf("adaptive bot amount: Increasing bots with %i to a total of %llu\n", deltaBots, bots.size());
-
-        } else if (deltaBots < 0) { // Remove bots
-            // Clean up old disabled bots, and then remove bots
-            unsigned int disabled = 0;
-            unsigned int deleted = 0;
-            int tmpDeltaBots = deltaBots;
-            for (unsigned int i=bots.size()-1; i>minBots; i--) {
-                // TODO fix possible O(n^2), but has a low call rate, low pri
-                if (!bots.at(i)->enabled) {
-                    deleted++;
-                    Ship* s = bots.at(i);
-                    assert(bots.at(i) == botsNode->children.at(i));
-                    bots.erase(bots.begin()+i);
-                    botsNode->children.erase(botsNode->children.begin()+i);
-                    delete s;
-                } else {
-                    if (tmpDeltaBots < 0) {
-                        bots.at(i)->enabled = false;
-                        tmpDeltaBots++; // Work towards 0
-                        disabled++;
-                    } else if (tmpDeltaBots == 0) {
-                        break;
-                    }
-                }
-            }
-            printf("adaptive bot amount: Decreasing bots with %i (%i disabled, %i deleted) to a size of %llu active and a total %llu\n", deltaBots, disabled, deleted, bots.size()-disabled, bots.size());
-        }
+    const float error = std::max(-maxLogError, std::min(std::log(frameBudgetMs / std::max(measuredMs, 0.01f)), maxLogError));
+    const float output = shipCountController.update(error, dt);
+    const unsigned int target = std::max(minBots, std::min((unsigned int) std::lround(referenceBots * std::exp(output)), maxBots));
+
+    if (target > bots) {
+        addBots(target - bots);
+    } else if (target < bots) {
+        removeBots(bots - target);
     }
-}
\ No newline at end of file
+
+    updateStaggerPeriods(measuredMs, Ship::entities.size());
+}
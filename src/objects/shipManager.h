@@ -1,12 +1,19 @@
 #pragma once
 
 #include "ship.h"
+#include "utilities/taskScheduler.h"
 
-int calculateAmountAdaptiveUpdateAmountBots(float &currentFps, double &time);
-int calculateBotDiff(float current, unsigned int target, float bpfps);
-void updateAmountBots(std::vector <Ship*> &bots, SceneNode* botsNode, float &currentFps, double &time);
-
-
-template <typename T> T clamp(const T& n, const T& lower, const T& upper);
-template <typename T> int sgn(T val);
+// One simulation step of all ships, shared by the game and the headless benchmark
+// The ships are updated in parallel when a scheduler is given, serially otherwise
+void updateShips(double deltaTime, TaskScheduler* scheduler);
+// Model and normal matrices of all ships, for rendering, after the simulation steps of the frame
+void updateShipTransforms(TaskScheduler* scheduler);
+// VP * model of all ships, after updateShipTransforms and whenever the camera moved
+void updateShipMVPs(const glm::mat4 &VP, TaskScheduler* scheduler);
 
+void setFrameBudget(float ms);
+void addBots(unsigned int count);
+void removeBots(unsigned int count);
+void updateStaggerPeriods(float frameMs, unsigned int ships);
+// Called every frame with the measured simulation and render time, adds or removes ships to fit the frame budget
+void updateAmountBots(float frameMs, double time);
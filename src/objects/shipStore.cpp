@@ -0,0 +1,26 @@
+#include "shipStore.h"
+
+unsigned int ShipStore::add(unsigned int shipId, const ShipSteering &shipSteering, const glm::vec3 &shipColor) {
+    unsigned int slot = kinematics.add();
+    id.push_back(shipId);
+    rotation.push_back(glm::vec3(0.0f));
+    model.push_back(glm::mat4(1.0f));
+    normal.push_back(glm::mat3(1.0f));
+    mvp.push_back(glm::mat4(1.0f));
+    color.push_back(shipColor);
+    weapon.push_back(ShipWeapon());
+    steering.push_back(shipSteering);
+    return slot;
+}
+
+void ShipStore::remove(unsigned int slot) {
+    kinematics.remove(slot);
+    swapRemove(id, slot);
+    swapRemove(rotation, slot);
+    swapRemove(model, slot);
+    swapRemove(normal, slot);
+    swapRemove(mvp, slot);
+    swapRemove(color, slot);
+    swapRemove(weapon, slot);
+    swapRemove(steering, slot);
+}
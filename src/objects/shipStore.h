@@ -0,0 +1,49 @@
+#ifndef GLOWBOX_SHIPSTORE_H
+#define GLOWBOX_SHIPSTORE_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include "flockStore.h"
+#include "flockKernel.h"
+#include "utilities/random.h"
+
+// Components of a ship entity, the kinematics are in FlockStore
+// The collider and the mesh are the same for every ship, so they are shared values in Ship instead of components
+
+struct ShipWeapon {
+    float refraction = 2.0f; // Seconds until the ship may fire, the first laser is delayed
+    bool fire = false;       // Set during the (parallel) update, the laser is spawned by Ship::updateLasers()
+    unsigned int hits = 0;   // Lasers that hit this ship
+};
+
+// State of the steering rules: the ships own random generator and the results reused by staggered tasks
+struct ShipSteering {
+    Random random;
+    FlockSums prevNeighbourSums;
+    glm::vec3 prevAntiCollision = glm::vec3(0.0f);
+    unsigned int staggerResults = 0; // Bit per task, set once the task has a result to reuse
+};
+
+// Every ship entity, one dense array per component, all indexed by the ships slot
+// A system only walks the arrays it needs, the flocking rules never pull a matrix or a random generator into the cache
+// Removing moves the last ship into the freed slot, so the arrays stay packed. The id moves along and stays unique
+class ShipStore {
+public:
+    FlockStore kinematics;                // Position, velocity, acceleration (double buffered) and the enabled flag
+    std::vector<unsigned int> id;
+    // Transform, one array per matrix so the batched matrix kernels can run over them
+    std::vector<glm::vec3> rotation;      // Euler angles, follows the velocity
+    std::vector<glm::mat4> model;         // Written by the transform pass, for rendering
+    std::vector<glm::mat3> normal;
+    std::vector<glm::mat4> mvp;           // VP * model, redone when the camera or the ships move
+    std::vector<glm::vec3> color;         // Render
+    std::vector<ShipWeapon> weapon;
+    std::vector<ShipSteering> steering;
+
+    unsigned int size() const { return kinematics.size(); }
+
+    unsigned int add(unsigned int shipId, const ShipSteering &shipSteering, const glm::vec3 &shipColor);
+    void remove(unsigned int slot);
+};
+
+#endif //GLOWBOX_SHIPSTORE_H
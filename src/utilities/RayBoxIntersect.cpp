@@ -1,13 +1,23 @@
 #include "RayBoxIntersect.h"
+#include "cpuFeatures.h"
+#include "random.h"
 #include <glm/vec3.hpp>
 #include <glm/geometric.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#ifdef GLOWBOX_X86
+    #include <immintrin.h>
+#endif
 
 
 Ray genRay(glm::vec3 pos, glm::vec3 dir) {
     return Ray{
         pos,
         dir,
-        1.0f/dir
+        1.0f/dir,
+        glm::length(dir)
     };
 }
 
@@ -41,7 +51,7 @@ BoundingBox genBoundingBox(glm::vec3 position, glm::vec3 dimension, glm::vec3 sc
      */
 }
 
-RayIntersection rayBoxIntersect(Ray ray, BoundingBox boundingBox) {
+RayIntersection rayBoxIntersect(const Ray &ray, const BoundingBox &boundingBox) {
     float tx1 = (boundingBox.min.x - ray.rayPos.x) * ray.rayFrac.x;
     float tx2 = (boundingBox.max.x - ray.rayPos.x) * ray.rayFrac.x;
 
@@ -65,26 +75,259 @@ RayIntersection rayBoxIntersect(Ray ray, BoundingBox boundingBox) {
     // tmin < 0    means ray origin is inside of AABB, and first intersect is at tmax (t = tmax)
     // tmin is the distance (in vectors) to the intersect (t = tmin)
     RayIntersection intersection{};
+    intersection.intersect = tmax >= tmin && tmax >= 0;
+    intersection.t = (!intersection.intersect || tmin < 0) ? tmax : tmin;
+    intersection.distance = intersection.intersect ? intersection.t * ray.rayDirLength : 0.0f; // t >= 0 on a hit
+    return intersection;
+}
+
+void rayBoxIntersectBatch(const glm::vec3 &origin, const float* dirX, const float* dirY, const float* dirZ,
+                          unsigned int count, const BoundingBox &boundingBox, float* hitT) {
+    RayPacket packet;
+    for (unsigned int lane = 0; lane < rayPacketSize; lane++) {
+        packet.posX[lane] = origin.x; packet.posY[lane] = origin.y; packet.posZ[lane] = origin.z;
+        packet.dirLength[lane] = 1.0f; // Distance in units of t
+    }
+
+    alignas(32) float distance[rayPacketSize];
+    for (unsigned int first = 0; first < count; first += rayPacketSize) {
+        const unsigned int lanes = std::min(rayPacketSize, count - first);
+        for (unsigned int lane = 0; lane < lanes; lane++) {
+            packet.fracX[lane] = 1.0f / dirX[first + lane];
+            packet.fracY[lane] = 1.0f / dirY[first + lane];
+            packet.fracZ[lane] = 1.0f / dirZ[first + lane];
+        }
+        rayBoxIntersectPacket(packet, boundingBox, lanes, distance);
+        std::copy(distance, distance + lanes, hitT + first);
+    }
+}
+
+/*
+ * Packet kernels
+ * Every kernel does the slab test of rayBoxIntersect lane by lane, with the box relative to the ray origin
+ * (lo = min - pos, hi = max - pos), and the same min/max order so the results match the scalar test.
+ */
+
+typedef unsigned int (*RayBoxesKernel)(const Ray &ray, const BoxPacket &boxes, unsigned int count, float* distance);
+typedef unsigned int (*RaysBoxKernel)(const RayPacket &rays, const BoundingBox &box, unsigned int count, float* distance);
+
+static unsigned int usedLanes(unsigned int count) {
+    return count >= rayPacketSize ? (1u << rayPacketSize) - 1 : (1u << count) - 1;
+}
+
+// Scalar lane, also the reference the SIMD kernels are verified against
+static bool slabLane(float loX, float hiX, float loY, float hiY, float loZ, float hiZ,
+                     float fracX, float fracY, float fracZ, float &t) {
+    float tx1 = loX * fracX, tx2 = hiX * fracX;
+    float ty1 = loY * fracY, ty2 = hiY * fracY;
+    float tz1 = loZ * fracZ, tz2 = hiZ * fracZ;
+    float tmin = dmnsn_max(dmnsn_max(dmnsn_min(tx1, tx2), dmnsn_min(ty1, ty2)), dmnsn_min(tz1, tz2));
+    float tmax = dmnsn_min(dmnsn_min(dmnsn_max(tx1, tx2), dmnsn_max(ty1, ty2)), dmnsn_max(tz1, tz2));
+    t = tmin < 0 ? tmax : tmin;
+    return tmax >= tmin && tmax >= 0;
+}
+
+static unsigned int rayBoxesScalar(const Ray &ray, const BoxPacket &b, unsigned int count, float* distance) {
+    const float infinity = std::numeric_limits<float>::infinity();
+    const glm::vec3 &p = ray.rayPos;
+    const glm::vec3 &f = ray.rayFrac;
+    unsigned int mask = 0;
+    for (unsigned int i = 0; i < rayPacketSize; i++) {
+        float t;
+        bool hit = i < count && slabLane(b.minX[i] - p.x, b.maxX[i] - p.x, b.minY[i] - p.y, b.maxY[i] - p.y,
+                                         b.minZ[i] - p.z, b.maxZ[i] - p.z, f.x, f.y, f.z, t);
+        distance[i] = hit ? t * ray.rayDirLength : infinity;
+        mask |= (hit ? 1u : 0u) << i;
+    }
+    return mask;
+}
+
+static unsigned int raysBoxScalar(const RayPacket &r, const BoundingBox &box, unsigned int count, float* distance) {
+    const float infinity = std::numeric_limits<float>::infinity();
+    unsigned int mask = 0;
+    for (unsigned int i = 0; i < rayPacketSize; i++) {
+        float t;
+        bool hit = i < count && slabLane(box.min.x - r.posX[i], box.max.x - r.posX[i], box.min.y - r.posY[i], box.max.y - r.posY[i],
+                                         box.min.z - r.posZ[i], box.max.z - r.posZ[i], r.fracX[i], r.fracY[i], r.fracZ[i], t);
+        distance[i] = hit ? t * r.dirLength[i] : infinity;
+        mask |= (hit ? 1u : 0u) << i;
+    }
+    return mask;
+}
+
+#ifdef GLOWBOX_X86
+
+// min/max are written as the compare and blend of dmnsn_min/dmnsn_max, _mm_min_ps(a, b) is a < b ? a : b as well
+
+GLOWBOX_TARGET_SSE
+static __m128 slabSSE(__m128 loX, __m128 hiX, __m128 loY, __m128 hiY, __m128 loZ, __m128 hiZ,
+                      __m128 fracX, __m128 fracY, __m128 fracZ, __m128 &hit) {
+    __m128 tx1 = _mm_mul_ps(loX, fracX), tx2 = _mm_mul_ps(hiX, fracX);
+    __m128 ty1 = _mm_mul_ps(loY, fracY), ty2 = _mm_mul_ps(hiY, fracY);
+    __m128 tz1 = _mm_mul_ps(loZ, fracZ), tz2 = _mm_mul_ps(hiZ, fracZ);
+    __m128 tmin = _mm_max_ps(_mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2)), _mm_min_ps(tz1, tz2));
+    __m128 tmax = _mm_min_ps(_mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2)), _mm_max_ps(tz1, tz2));
+    const __m128 zero = _mm_setzero_ps();
+    hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmpge_ps(tmax, zero));
+    __m128 inside = _mm_cmplt_ps(tmin, zero);
+    return _mm_or_ps(_mm_and_ps(inside, tmax), _mm_andnot_ps(inside, tmin));
+}
+
+GLOWBOX_TARGET_SSE
+static unsigned int storeSSE(__m128 t, __m128 hit, __m128 length, float* distance) {
+    const __m128 infinity = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    __m128 d = _mm_mul_ps(t, length);
+    _mm_storeu_ps(distance, _mm_or_ps(_mm_and_ps(hit, d), _mm_andnot_ps(hit, infinity)));
+    return (unsigned int) _mm_movemask_ps(hit);
+}
 
-    // So much for being branchless
-    if (tmax < 0) { // Intersection on wrong side
-        intersection.intersect = false;
-        intersection.t = tmax;
+GLOWBOX_TARGET_SSE
+static unsigned int rayBoxesSSE(const Ray &ray, const BoxPacket &b, unsigned int count, float* distance) {
+    const __m128 px = _mm_set1_ps(ray.rayPos.x), py = _mm_set1_ps(ray.rayPos.y), pz = _mm_set1_ps(ray.rayPos.z);
+    const __m128 fx = _mm_set1_ps(ray.rayFrac.x), fy = _mm_set1_ps(ray.rayFrac.y), fz = _mm_set1_ps(ray.rayFrac.z);
+    const __m128 length = _mm_set1_ps(ray.rayDirLength);
+    unsigned int mask = 0;
+    for (unsigned int half = 0; half < rayPacketSize; half += 4) {
+        __m128 hit;
+        __m128 t = slabSSE(_mm_sub_ps(_mm_loadu_ps(b.minX + half), px), _mm_sub_ps(_mm_loadu_ps(b.maxX + half), px),
+                           _mm_sub_ps(_mm_loadu_ps(b.minY + half), py), _mm_sub_ps(_mm_loadu_ps(b.maxY + half), py),
+                           _mm_sub_ps(_mm_loadu_ps(b.minZ + half), pz), _mm_sub_ps(_mm_loadu_ps(b.maxZ + half), pz),
+                           fx, fy, fz, hit);
+        mask |= storeSSE(t, hit, length, distance + half) << half;
     }
+    const unsigned int used = usedLanes(count);
+    for (unsigned int i = 0; i < rayPacketSize; i++) {
+        if (!(used & (1u << i))) distance[i] = std::numeric_limits<float>::infinity();
+    }
+    return mask & used;
+}
 
-    if (tmin > tmax) { // No intersection
-        intersection.intersect = false;
-        intersection.t = tmax;
+GLOWBOX_TARGET_SSE
+static unsigned int raysBoxSSE(const RayPacket &r, const BoundingBox &box, unsigned int count, float* distance) {
+    const __m128 minX = _mm_set1_ps(box.min.x), minY = _mm_set1_ps(box.min.y), minZ = _mm_set1_ps(box.min.z);
+    const __m128 maxX = _mm_set1_ps(box.max.x), maxY = _mm_set1_ps(box.max.y), maxZ = _mm_set1_ps(box.max.z);
+    unsigned int mask = 0;
+    for (unsigned int half = 0; half < rayPacketSize; half += 4) {
+        const __m128 px = _mm_loadu_ps(r.posX + half), py = _mm_loadu_ps(r.posY + half), pz = _mm_loadu_ps(r.posZ + half);
+        __m128 hit;
+        __m128 t = slabSSE(_mm_sub_ps(minX, px), _mm_sub_ps(maxX, px),
+                           _mm_sub_ps(minY, py), _mm_sub_ps(maxY, py),
+                           _mm_sub_ps(minZ, pz), _mm_sub_ps(maxZ, pz),
+                           _mm_loadu_ps(r.fracX + half), _mm_loadu_ps(r.fracY + half), _mm_loadu_ps(r.fracZ + half), hit);
+        mask |= storeSSE(t, hit, _mm_loadu_ps(r.dirLength + half), distance + half) << half;
     }
+    const unsigned int used = usedLanes(count);
+    for (unsigned int i = 0; i < rayPacketSize; i++) {
+        if (!(used & (1u << i))) distance[i] = std::numeric_limits<float>::infinity();
+    }
+    return mask & used;
+}
+
+GLOWBOX_TARGET_AVX2
+static __m256 slabAVX2(__m256 loX, __m256 hiX, __m256 loY, __m256 hiY, __m256 loZ, __m256 hiZ,
+                       __m256 fracX, __m256 fracY, __m256 fracZ, __m256 &hit) {
+    __m256 tx1 = _mm256_mul_ps(loX, fracX), tx2 = _mm256_mul_ps(hiX, fracX);
+    __m256 ty1 = _mm256_mul_ps(loY, fracY), ty2 = _mm256_mul_ps(hiY, fracY);
+    __m256 tz1 = _mm256_mul_ps(loZ, fracZ), tz2 = _mm256_mul_ps(hiZ, fracZ);
+    __m256 tmin = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(tx1, tx2), _mm256_min_ps(ty1, ty2)), _mm256_min_ps(tz1, tz2));
+    __m256 tmax = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(tx1, tx2), _mm256_max_ps(ty1, ty2)), _mm256_max_ps(tz1, tz2));
+    const __m256 zero = _mm256_setzero_ps();
+    hit = _mm256_and_ps(_mm256_cmp_ps(tmax, tmin, _CMP_GE_OQ), _mm256_cmp_ps(tmax, zero, _CMP_GE_OQ));
+    return _mm256_blendv_ps(tmin, tmax, _mm256_cmp_ps(tmin, zero, _CMP_LT_OQ));
+}
+
+GLOWBOX_TARGET_AVX2
+static unsigned int storeAVX2(__m256 t, __m256 hit, __m256 length, unsigned int count, float* distance) {
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 used = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32((int) count), lane));
+    hit = _mm256_and_ps(hit, used);
+    const __m256 infinity = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+    _mm256_storeu_ps(distance, _mm256_blendv_ps(infinity, _mm256_mul_ps(t, length), hit));
+    return (unsigned int) _mm256_movemask_ps(hit);
+}
+
+GLOWBOX_TARGET_AVX2
+static unsigned int rayBoxesAVX2(const Ray &ray, const BoxPacket &b, unsigned int count, float* distance) {
+    const __m256 px = _mm256_set1_ps(ray.rayPos.x), py = _mm256_set1_ps(ray.rayPos.y), pz = _mm256_set1_ps(ray.rayPos.z);
+    __m256 hit;
+    __m256 t = slabAVX2(_mm256_sub_ps(_mm256_loadu_ps(b.minX), px), _mm256_sub_ps(_mm256_loadu_ps(b.maxX), px),
+                        _mm256_sub_ps(_mm256_loadu_ps(b.minY), py), _mm256_sub_ps(_mm256_loadu_ps(b.maxY), py),
+                        _mm256_sub_ps(_mm256_loadu_ps(b.minZ), pz), _mm256_sub_ps(_mm256_loadu_ps(b.maxZ), pz),
+                        _mm256_set1_ps(ray.rayFrac.x), _mm256_set1_ps(ray.rayFrac.y), _mm256_set1_ps(ray.rayFrac.z), hit);
+    return storeAVX2(t, hit, _mm256_set1_ps(ray.rayDirLength), count, distance);
+}
 
-    if (tmax >= tmin && tmax >= 0) { // Intersect
-        intersection.intersect = true;
-        if (tmin < 0) { // inside
-            intersection.t = tmax;
-        } else {
-            intersection.t = tmin;
+GLOWBOX_TARGET_AVX2
+static unsigned int raysBoxAVX2(const RayPacket &r, const BoundingBox &box, unsigned int count, float* distance) {
+    const __m256 px = _mm256_loadu_ps(r.posX), py = _mm256_loadu_ps(r.posY), pz = _mm256_loadu_ps(r.posZ);
+    __m256 hit;
+    __m256 t = slabAVX2(_mm256_sub_ps(_mm256_set1_ps(box.min.x), px), _mm256_sub_ps(_mm256_set1_ps(box.max.x), px),
+                        _mm256_sub_ps(_mm256_set1_ps(box.min.y), py), _mm256_sub_ps(_mm256_set1_ps(box.max.y), py),
+                        _mm256_sub_ps(_mm256_set1_ps(box.min.z), pz), _mm256_sub_ps(_mm256_set1_ps(box.max.z), pz),
+                        _mm256_loadu_ps(r.fracX), _mm256_loadu_ps(r.fracY), _mm256_loadu_ps(r.fracZ), hit);
+    return storeAVX2(t, hit, _mm256_loadu_ps(r.dirLength), count, distance);
+}
+
+#endif
+
+static bool sameResult(unsigned int maskA, const float* a, unsigned int maskB, const float* b) {
+    if (maskA != maskB) return false;
+    for (unsigned int i = 0; i < rayPacketSize; i++) {
+        if (std::isinf(a[i]) != std::isinf(b[i])) return false;
+        if (!std::isinf(b[i]) && std::abs(a[i] - b[i]) > 1e-4f * std::max(1.0f, std::abs(b[i]))) return false;
+    }
+    return true;
+}
+
+/// Run both kernels on fixed pseudo random packets (hits, misses, origins inside boxes, partial packets)
+/// and compare them to the scalar kernels
+static bool verifyPacketKernels(RayBoxesKernel rayBoxes, RaysBoxKernel raysBox) {
+    Random random(4321);
+    auto nextFloat = [&random]() { return random.nextFloat() * 40.0f - 20.0f; };
+    for (unsigned int round = 0; round < 16; round++) {
+        const unsigned int count = round % (rayPacketSize + 1);
+        BoxPacket boxes;
+        RayPacket rays;
+        for (unsigned int i = 0; i < rayPacketSize; i++) {
+            glm::vec3 center(nextFloat(), nextFloat(), nextFloat());
+            glm::vec3 half = glm::abs(glm::vec3(nextFloat(), nextFloat(), nextFloat())) * 0.5f + 1.0f;
+            boxes.set(i, BoundingBox{center - half, center + half});
+            rays.set(i, genRay(glm::vec3(nextFloat(), nextFloat(), nextFloat()), glm::vec3(nextFloat(), nextFloat(), nextFloat())));
         }
-        intersection.distance = glm::length(intersection.t * ray.rayDir);
+        const Ray ray = genRay(glm::vec3(nextFloat(), nextFloat(), nextFloat()) * 0.1f, glm::vec3(nextFloat(), nextFloat(), nextFloat()));
+        const BoundingBox box{glm::vec3(-8.0f), glm::vec3(8.0f)};
+
+        float expected[rayPacketSize], actual[rayPacketSize];
+        unsigned int expectedMask = rayBoxesScalar(ray, boxes, count, expected);
+        if (!sameResult(rayBoxes(ray, boxes, count, actual), actual, expectedMask, expected)) return false;
+        expectedMask = raysBoxScalar(rays, box, count, expected);
+        if (!sameResult(raysBox(rays, box, count, actual), actual, expectedMask, expected)) return false;
     }
-    return intersection;
+    return true;
+}
+
+struct PacketKernels {
+    RayBoxesKernel rayBoxes;
+    RaysBoxKernel raysBox;
+};
+
+static const SelectedKernels<PacketKernels> &selectedPacketKernels() {
+    static const SelectedKernels<PacketKernels> selected = selectKernels<PacketKernels>("Ray packet",
+            {GLOWBOX_SIMD_OR_SCALAR(rayBoxesAVX2, rayBoxesScalar), GLOWBOX_SIMD_OR_SCALAR(raysBoxAVX2, raysBoxScalar)},
+            {GLOWBOX_SIMD_OR_SCALAR(rayBoxesSSE, rayBoxesScalar), GLOWBOX_SIMD_OR_SCALAR(raysBoxSSE, raysBoxScalar)},
+            {rayBoxesScalar, raysBoxScalar},
+            [](const PacketKernels &k) { return verifyPacketKernels(k.rayBoxes, k.raysBox); });
+    return selected;
+}
+
+unsigned int rayBoxIntersectPacket(const Ray &ray, const BoxPacket &boxes, unsigned int count, float* distance) {
+    return selectedPacketKernels().kernels.rayBoxes(ray, boxes, count, distance);
+}
+
+unsigned int rayBoxIntersectPacket(const RayPacket &rays, const BoundingBox &box, unsigned int count, float* distance) {
+    return selectedPacketKernels().kernels.raysBox(rays, box, count, distance);
+}
+
+const char* getRayPacketKernelName() {
+    return selectedPacketKernels().name;
 }
@@ -12,6 +12,7 @@ struct Ray{
     glm::vec3 rayPos;
     glm::vec3 rayDir;
     glm::vec3 rayFrac;
+    float rayDirLength; // Turns the ray parameter t into a distance
 };
 
 struct RayIntersection{
@@ -22,7 +23,46 @@ struct RayIntersection{
 
 Ray genRay(glm::vec3 pos, glm::vec3 dir);
 BoundingBox genBoundingBox(glm::vec3 position, glm::vec3 dimension, glm::vec3 scale);
-RayIntersection rayBoxIntersect(Ray ray, BoundingBox boundingBox);
+RayIntersection rayBoxIntersect(const Ray &ray, const BoundingBox &boundingBox);
+
+// Same test as rayBoxIntersect for count rays sharing one origin, against one box
+// The directions are separate arrays (structure of arrays), tested a packet at a time
+// hitT[i] is the ray parameter of the intersection (the distance for unit directions), or infinity on a miss
+void rayBoxIntersectBatch(const glm::vec3 &origin, const float* dirX, const float* dirY, const float* dirZ,
+                          unsigned int count, const BoundingBox &boundingBox, float* hitT);
+
+// Packets of rays or boxes, one array per component, so a whole packet is tested with a few SIMD instructions
+// The AVX2 version tests a packet at once, the SSE version in two halves, picked at runtime like the flock kernel
+const unsigned int rayPacketSize = 8;
+
+struct alignas(32) RayPacket {
+    float posX[rayPacketSize] = {}, posY[rayPacketSize] = {}, posZ[rayPacketSize] = {};
+    float fracX[rayPacketSize] = {}, fracY[rayPacketSize] = {}, fracZ[rayPacketSize] = {};
+    float dirLength[rayPacketSize] = {};
+
+    void set(unsigned int lane, const Ray &ray) {
+        posX[lane] = ray.rayPos.x; posY[lane] = ray.rayPos.y; posZ[lane] = ray.rayPos.z;
+        fracX[lane] = ray.rayFrac.x; fracY[lane] = ray.rayFrac.y; fracZ[lane] = ray.rayFrac.z;
+        dirLength[lane] = ray.rayDirLength;
+    }
+};
+
+struct alignas(32) BoxPacket {
+    float minX[rayPacketSize] = {}, minY[rayPacketSize] = {}, minZ[rayPacketSize] = {};
+    float maxX[rayPacketSize] = {}, maxY[rayPacketSize] = {}, maxZ[rayPacketSize] = {};
+
+    void set(unsigned int lane, const BoundingBox &box) {
+        minX[lane] = box.min.x; minY[lane] = box.min.y; minZ[lane] = box.min.z;
+        maxX[lane] = box.max.x; maxY[lane] = box.max.y; maxZ[lane] = box.max.z;
+    }
+};
+
+// One ray against the first count boxes of a packet, or the first count rays of a packet against one box
+// Returns a mask with bit i set if lane i intersects, distance (rayPacketSize floats) gets the same distance as
+// rayBoxIntersect for hits and infinity for misses and unused lanes
+unsigned int rayBoxIntersectPacket(const Ray &ray, const BoxPacket &boxes, unsigned int count, float* distance);
+unsigned int rayBoxIntersectPacket(const RayPacket &rays, const BoundingBox &box, unsigned int count, float* distance);
+const char* getRayPacketKernelName();
 
 // https://distantsoulsdev.blogspot.com/2013/03/adventures-in-branchless-min-max-with.html
 // https://stackoverflow.com/questions/40196817/what-is-the-instruction-that-gives-branchless-fp-min-and-max-on-x86
@@ -0,0 +1,76 @@
+#include "boundingVolumeHierarchy.h"
+#include <algorithm>
+#include <cassert>
+
+static BoundingBox merge(const BoundingBox &a, const BoundingBox &b) {
+    return BoundingBox{glm::min(a.min, b.min), glm::max(a.max, b.max)};
+}
+
+static glm::vec3 centroid(const BoundingBox &box) {
+    return (box.min + box.max) * 0.5f;
+}
+
+void BoundingVolumeHierarchy::build(const std::vector<BoundingBox> &newBoxes) {
+    boxes = newBoxes;
+    nodes.clear();
+    primitives.resize(boxes.size());
+    for (unsigned int i = 0; i < primitives.size(); i++) primitives[i] = i;
+    if (boxes.empty()) return;
+
+    nodes.reserve(2 * boxes.size());
+    buildNode(0, (unsigned int) boxes.size(), 0);
+}
+
+unsigned int BoundingVolumeHierarchy::buildNode(unsigned int first, unsigned int count, unsigned int depth) {
+    unsigned int index = (unsigned int) nodes.size();
+    nodes.push_back(Node{});
+
+    BoundingBox bounds = boxes[primitives[first]];
+    BoundingBox centroidBounds{centroid(bounds), centroid(bounds)};
+    for (unsigned int i = first + 1; i < first + count; i++) {
+        bounds = merge(bounds, boxes[primitives[i]]);
+        glm::vec3 c = centroid(boxes[primitives[i]]);
+        centroidBounds = merge(centroidBounds, BoundingBox{c, c});
+    }
+    nodes[index].bounds = bounds;
+
+    if (count <= maxLeafSize || depth + 2 >= maxDepth) {
+        nodes[index].first = first;
+        nodes[index].count = count;
+        return index;
+    }
+
+    // Median split along the axis where the centroids are most spread out
+    glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    unsigned int half = count / 2;
+    std::nth_element(primitives.begin() + first, primitives.begin() + first + half, primitives.begin() + first + count,
+                     [this, axis](unsigned int a, unsigned int b) {
+                         return centroid(boxes[a])[axis] < centroid(boxes[b])[axis];
+                     });
+
+    buildNode(first, half, depth + 1); // Left child, directly after this node
+    unsigned int right = buildNode(first + half, count - half, depth + 1);
+    nodes[index].first = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+void BoundingVolumeHierarchy::refit(const std::vector<BoundingBox> &newBoxes) {
+    assert(newBoxes.size() == boxes.size());
+    boxes = newBoxes;
+    if (!nodes.empty()) refitNode(0);
+}
+
+void BoundingVolumeHierarchy::refitNode(unsigned int index) {
+    Node &node = nodes[index];
+    if (node.count > 0) {
+        BoundingBox bounds = boxes[primitives[node.first]];
+        for (unsigned int i = node.first + 1; i < node.first + node.count; i++) bounds = merge(bounds, boxes[primitives[i]]);
+        node.bounds = bounds;
+        return;
+    }
+    refitNode(index + 1);
+    refitNode(node.first);
+    node.bounds = merge(nodes[index + 1].bounds, nodes[node.first].bounds);
+}
@@ -0,0 +1,144 @@
+#ifndef GLOWBOX_BOUNDINGVOLUMEHIERARCHY_H
+#define GLOWBOX_BOUNDINGVOLUMEHIERARCHY_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <vector>
+#include <limits>
+#include "RayBoxIntersect.h"
+
+// Bounding volume hierarchy over a set of axis aligned boxes, for ray and radius queries against many obstacles
+// Built top-down by splitting the longest axis at the median centroid, stored as a flat array (left child follows its parent)
+// Moving boxes are handled by refit(), which keeps the tree and only recomputes the bounds bottom-up,
+// as long as the boxes do not move much relative to each other the tree stays good.
+// Boxes are referenced by their index in the array given to build()
+class BoundingVolumeHierarchy {
+private:
+    struct Node {
+        BoundingBox bounds;
+        unsigned int first; // Leaf: first entry in primitives, interior: index of the right child
+        unsigned int count; // Number of primitives in a leaf, 0 for interior nodes
+    };
+
+    static const unsigned int maxLeafSize = 2;
+    static const unsigned int maxDepth = 64; // Traversal stack, a median split tree never gets close
+
+    std::vector<Node> nodes;
+    std::vector<unsigned int> primitives; // Box indices, ordered by leaf
+    std::vector<BoundingBox> boxes;       // Copy of the boxes, by box index
+
+    unsigned int buildNode(unsigned int first, unsigned int count, unsigned int depth);
+    void refitNode(unsigned int node);
+
+    // Distance along the ray where it enters the box (0 if the origin is inside), infinity on a miss
+    static float entryDistance(const Ray &ray, const BoundingBox &box) {
+        RayIntersection intersection = rayBoxIntersect(ray, box);
+        if (!intersection.intersect) return std::numeric_limits<float>::infinity();
+        const glm::vec3 &p = ray.rayPos;
+        bool inside = box.min.x <= p.x && p.x <= box.max.x && box.min.y <= p.y && p.y <= box.max.y
+                   && box.min.z <= p.z && p.z <= box.max.z;
+        return inside ? 0.0f : intersection.distance;
+    }
+
+    static bool overlapsSphere(const BoundingBox &box, const glm::vec3 &center, float radius) {
+        glm::vec3 closest = glm::max(box.min, glm::min(center, box.max));
+        glm::vec3 d = center - closest;
+        return glm::dot(d, d) <= radius * radius;
+    }
+
+public:
+    unsigned int size() const { return (unsigned int) boxes.size(); }
+    const BoundingBox &getBox(unsigned int index) const { return boxes[index]; }
+
+    void build(const std::vector<BoundingBox> &newBoxes);
+    // Same number of boxes as the last build, in the same order
+    void refit(const std::vector<BoundingBox> &newBoxes);
+
+    /// Visit every box the ray hits within maxDistance
+    /// @param callback called as callback(index, intersection) with the same intersection as rayBoxIntersect
+    template<typename F>
+    void forEachRayHit(const Ray &ray, float maxDistance, F &&callback) const {
+        if (nodes.empty()) return;
+        unsigned int stack[maxDepth];
+        unsigned int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const unsigned int index = stack[--stackSize];
+            const Node &node = nodes[index];
+            if (entryDistance(ray, node.bounds) > maxDistance) continue;
+            if (node.count > 0) {
+                for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                    RayIntersection intersection = rayBoxIntersect(ray, boxes[primitives[i]]);
+                    if (intersection.intersect && intersection.distance <= maxDistance) callback(primitives[i], intersection);
+                }
+            } else {
+                stack[stackSize++] = node.first;
+                stack[stackSize++] = index + 1;
+            }
+        }
+    }
+
+    /// Closest box hit by the ray within maxDistance, nodes further away than the best hit so far are skipped
+    /// @param accept optional filter accept(index), to ignore some boxes (like disabled nodes)
+    /// @return index of the box, or size() if nothing was hit
+    template<typename F>
+    unsigned int nearestHit(const Ray &ray, float maxDistance, RayIntersection &nearest, F &&accept) const {
+        unsigned int best = size();
+        if (nodes.empty()) return best;
+        float bestDistance = maxDistance;
+        unsigned int stack[maxDepth];
+        unsigned int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const unsigned int index = stack[--stackSize];
+            const Node &node = nodes[index];
+            if (entryDistance(ray, node.bounds) > bestDistance) continue;
+            if (node.count > 0) {
+                for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                    RayIntersection intersection = rayBoxIntersect(ray, boxes[primitives[i]]);
+                    if (intersection.intersect && intersection.distance <= bestDistance && accept(primitives[i])) {
+                        best = primitives[i];
+                        bestDistance = intersection.distance;
+                        nearest = intersection;
+                    }
+                }
+            } else {
+                // Visit the closer child first, so the further one is more likely to be culled
+                unsigned int left = index + 1, right = node.first;
+                if (entryDistance(ray, nodes[left].bounds) > entryDistance(ray, nodes[right].bounds)) std::swap(left, right);
+                stack[stackSize++] = right;
+                stack[stackSize++] = left;
+            }
+        }
+        return best;
+    }
+
+    unsigned int nearestHit(const Ray &ray, float maxDistance, RayIntersection &nearest) const {
+        return nearestHit(ray, maxDistance, nearest, [](unsigned int) { return true; });
+    }
+
+    /// Visit every box overlapping the sphere
+    /// @param callback called as callback(index)
+    template<typename F>
+    void forEachInRadius(const glm::vec3 &center, float radius, F &&callback) const {
+        if (nodes.empty()) return;
+        unsigned int stack[maxDepth];
+        unsigned int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const unsigned int index = stack[--stackSize];
+            const Node &node = nodes[index];
+            if (!overlapsSphere(node.bounds, center, radius)) continue;
+            if (node.count > 0) {
+                for (unsigned int i = node.first; i < node.first + node.count; i++) {
+                    if (overlapsSphere(boxes[primitives[i]], center, radius)) callback(primitives[i]);
+                }
+            } else {
+                stack[stackSize++] = node.first;
+                stack[stackSize++] = index + 1;
+            }
+        }
+    }
+};
+
+#endif //GLOWBOX_BOUNDINGVOLUMEHIERARCHY_H
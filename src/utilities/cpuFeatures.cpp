@@ -0,0 +1,35 @@
+#include "cpuFeatures.h"
+
+#if defined(GLOWBOX_X86) && defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+    #include <immintrin.h>
+#endif
+
+bool cpuHasSSE2() {
+#if !defined(GLOWBOX_X86)
+    return false;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool cpuHasAVX2() {
+#if !defined(GLOWBOX_X86)
+    return false;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6; // OSXSAVE and the os saves the ymm registers
+    bool hasFma = (info[2] & (1 << 12)) != 0;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && hasFma && (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
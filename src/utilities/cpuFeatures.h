@@ -0,0 +1,54 @@
+#ifndef GLOWBOX_CPUFEATURES_H
+#define GLOWBOX_CPUFEATURES_H
+
+// Runtime cpu feature detection, used to pick between scalar and SIMD kernels
+// The SIMD kernels are compiled with per-function target attributes, so the executable still runs on cpus without them
+
+#include <cstdio>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define GLOWBOX_X86 1
+#endif
+
+// The SIMD kernels are only compiled for x86, elsewhere their candidate slot holds the scalar kernel (and is never picked)
+#ifdef GLOWBOX_X86
+    #define GLOWBOX_SIMD_OR_SCALAR(simd, scalar) simd
+#else
+    #define GLOWBOX_SIMD_OR_SCALAR(simd, scalar) scalar
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+    #define GLOWBOX_TARGET_SSE
+    #define GLOWBOX_TARGET_AVX2
+#else
+    #define GLOWBOX_TARGET_SSE __attribute__((target("sse2")))
+    #define GLOWBOX_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+bool cpuHasSSE2();
+bool cpuHasAVX2();
+
+// A set of kernels (one function pointer, or a struct of them) and the instruction set it was picked for
+template<typename Kernels>
+struct SelectedKernels {
+    Kernels kernels;
+    const char* name;
+};
+
+/// Widest of the AVX2 and SSE kernel sets that the cpu supports and that pass verify(kernels), the scalar set otherwise
+/// verify compares a candidate to the scalar kernels, a rejected set is reported on stderr as "<family> kernel ..."
+/// Call it to initialise a function local static, that makes the selection thread safe and only run once
+template<typename Kernels, typename Verify>
+SelectedKernels<Kernels> selectKernels(const char* family, const Kernels &avx2, const Kernels &sse, const Kernels &scalar,
+                                       const Verify &verify) {
+    const SelectedKernels<Kernels> candidates[] = {{avx2, "AVX2"}, {sse, "SSE"}};
+    const bool supported[] = {cpuHasAVX2(), cpuHasSSE2()};
+    for (int i = 0; i < 2; i++) {
+        if (!supported[i]) continue;
+        if (verify(candidates[i].kernels)) return candidates[i];
+        fprintf(stderr, "%s kernel %s does not match the scalar kernel, skipping it\n", family, candidates[i].name);
+    }
+    return SelectedKernels<Kernels>{scalar, "scalar"};
+}
+
+#endif //GLOWBOX_CPUFEATURES_H
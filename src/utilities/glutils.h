@@ -1,8 +1,9 @@
 #pragma once
 
 #include "mesh.h"
-#include "imageLoader.hpp"
-#include <glad/glad.h>
 
-GLuint generateBuffer(Mesh &mesh);
+// No GL types here, so the simulation code can be linked against a null render backend (see bench/)
+struct PNGImage;
+
+unsigned int generateBuffer(Mesh &mesh);
 unsigned int getTextureID(PNGImage* img);
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "matrixBatch.h"
+#include "cpuFeatures.h"
+#include "random.h"
+#include <algorithm>
+#include <cmath>
+
+#ifdef GLOWBOX_X86
+    #include <immintrin.h>
+#endif
+
+// glm matrices are four columns of four floats, column major and without padding
+static const float* columns(const glm::mat4 &m) { return &m[0][0]; }
+static float* columns(glm::mat4 &m) { return &m[0][0]; }
+
+// Reference implementations, the glm products
+void multiplyMatricesScalar(const glm::mat4 &lhs, const glm::mat4* rhs, glm::mat4* out, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) out[i] = lhs * rhs[i];
+}
+
+void multiplyAffineScalar(const glm::mat4* const* lhs, const glm::mat4* rhs, glm::mat4* out, glm::vec3* translation, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        out[i] = *lhs[i] * rhs[i];
+        if (translation != nullptr) translation[i] = glm::vec3(out[i][3]);
+    }
+}
+
+#ifdef GLOWBOX_X86
+
+// A column of the product is the lhs columns weighted by the components of the rhs column
+// The rhs is read completely before anything is written, so out may be rhs
+
+GLOWBOX_TARGET_SSE
+static inline __m128 combineSSE(__m128 l0, __m128 l1, __m128 l2, __m128 l3, __m128 r) {
+    __m128 xy = _mm_add_ps(_mm_mul_ps(l0, _mm_shuffle_ps(r, r, 0x00)), _mm_mul_ps(l1, _mm_shuffle_ps(r, r, 0x55)));
+    __m128 zw = _mm_add_ps(_mm_mul_ps(l2, _mm_shuffle_ps(r, r, 0xAA)), _mm_mul_ps(l3, _mm_shuffle_ps(r, r, 0xFF)));
+    return _mm_add_ps(xy, zw);
+}
+
+GLOWBOX_TARGET_SSE
+void multiplyMatricesSSE(const glm::mat4 &lhs, const glm::mat4* rhs, glm::mat4* out, unsigned int count) {
+    const float* l = columns(lhs);
+    const __m128 l0 = _mm_loadu_ps(l), l1 = _mm_loadu_ps(l + 4), l2 = _mm_loadu_ps(l + 8), l3 = _mm_loadu_ps(l + 12);
+    for (unsigned int i = 0; i < count; i++) {
+        const float* r = columns(rhs[i]);
+        const __m128 r0 = _mm_loadu_ps(r), r1 = _mm_loadu_ps(r + 4), r2 = _mm_loadu_ps(r + 8), r3 = _mm_loadu_ps(r + 12);
+        float* o = columns(out[i]);
+        _mm_storeu_ps(o, combineSSE(l0, l1, l2, l3, r0));
+        _mm_storeu_ps(o + 4, combineSSE(l0, l1, l2, l3, r1));
+        _mm_storeu_ps(o + 8, combineSSE(l0, l1, l2, l3, r2));
+        _mm_storeu_ps(o + 12, combineSSE(l0, l1, l2, l3, r3));
+    }
+}
+
+// Affine: the first three rhs columns have w = 0 and the last w = 1, so the products with the last lhs column are skipped
+GLOWBOX_TARGET_SSE
+static inline __m128 combineAffineSSE(__m128 l0, __m128 l1, __m128 l2, __m128 r) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(l0, _mm_shuffle_ps(r, r, 0x00)), _mm_mul_ps(l1, _mm_shuffle_ps(r, r, 0x55))),
+                      _mm_mul_ps(l2, _mm_shuffle_ps(r, r, 0xAA)));
+}
+
+GLOWBOX_TARGET_SSE
+void multiplyAffineSSE(const glm::mat4* const* lhs, const glm::mat4* rhs, glm::mat4* out, glm::vec3* translation, unsigned int count) {
+    for (unsigned int i = 0; i < count; i++) {
+        const float* l = columns(*lhs[i]);
+        const __m128 l0 = _mm_loadu_ps(l), l1 = _mm_loadu_ps(l + 4), l2 = _mm_loadu_ps(l + 8), l3 = _mm_loadu_ps(l + 12);
+        const float* r = columns(rhs[i]);
+        const __m128 r0 = _mm_loadu_ps(r), r1 = _mm_loadu_ps(r + 4), r2 = _mm_loadu_ps(r + 8), r3 = _mm_loadu_ps(r + 12);
+        float* o = columns(out[i]);
+        _mm_storeu_ps(o, combineAffineSSE(l0, l1, l2, r0));
+        _mm_storeu_ps(o + 4, combineAffineSSE(l0, l1, l2, r1));
+        _mm_storeu_ps(o + 8, combineAffineSSE(l0, l1, l2, r2));
+        _mm_storeu_ps(o + 12, _mm_add_ps(combineAffineSSE(l0, l1, l2, r3), l3));
+        if (translation != nullptr) translation[i] = glm::vec3(o[12], o[13], o[14]);
+    }
+}
+
+// Two columns per register, the lhs columns are repeated in both halves
+GLOWBOX_TARGET_AVX2
+static inline __m256 combineAVX2(__m256 l0, __m256 l1, __m256 l2, __m256 l3, __m256 r) {
+    __m256 sum = _mm256_mul_ps(l0, _mm256_permute_ps(r, 0x00));
+    sum = _mm256_fmadd_ps(l1, _mm256_permute_ps(r, 0x55), sum);
+    sum = _mm256_fmadd_ps(l2, _mm256_permute_ps(r, 0xAA), sum);
+    return _mm256_fmadd_ps(l3, _mm256_permute_ps(r, 0xFF), sum);
+}
+
+GLOWBOX_TARGET_AVX2
+static inline __m256 combineAffineAVX2(__m256 l0, __m256 l1, __m256 l2, __m256 r) {
+    __m256 sum = _mm256_mul_ps(l0, _mm256_permute_ps(r, 0x00));
+    sum = _mm256_fmadd_ps(l1, _mm256_permute_ps(r, 0x55), sum);
+    return _mm256_fmadd_ps(l2, _mm256_permute_ps(r, 0xAA), sum);
+}
+
+GLOWBOX_TARGET_AVX2
+void multiplyMatricesAVX2(const glm::mat4 &lhs, const glm::mat4* rhs, glm::mat4* out, unsigned int count) {
+    const float* l = columns(lhs);
+    const __m256 l0 = _mm256_broadcast_ps((const __m128*) l), l1 = _mm256_broadcast_ps((const __m128*) (l + 4));
+    const __m256 l2 = _mm256_broadcast_ps((const __m128*) (l + 8)), l3 = _mm256_broadcast_ps((const __m128*) (l + 12));
+    for (unsigned int i = 0; i < count; i++) {
+        const float* r = columns(rhs[i]);
+        const __m256 r01 = _mm256_loadu_ps(r), r23 = _mm256_loadu_ps(r + 8);
+        float* o = columns(out[i]);
+        _mm256_storeu_ps(o, combineAVX2(l0, l1, l2, l3, r01));
+        _mm256_storeu_ps(o + 8, combineAVX2(l0, l1, l2, l3, r23));
+    }
+}
+
+GLOWBOX_TARGET_AVX2
+void multiplyAffineAVX2(const glm::mat4* const* lhs, const glm::mat4* rhs, glm::mat4* out, glm::vec3* translation, unsigned int count) {
+    // Adds the last lhs column to the second half only, the translation column
+    const __m256 upperHalf = _mm256_castsi256_ps(_mm256_setr_epi32(0, 0, 0, 0, -1, -1, -1, -1));
+    for (unsigned int i = 0; i < count; i++) {
+        const float* l = columns(*lhs[i]);
+        const __m256 l0 = _mm256_broadcast_ps((const __m128*) l), l1 = _mm256_broadcast_ps((const __m128*) (l + 4));
+        const __m256 l2 = _mm256_broadcast_ps((const __m128*) (l + 8));
+        const __m256 l3 = _mm256_and_ps(_mm256_broadcast_ps((const __m128*) (l + 12)), upperHalf);
+        const float* r = columns(rhs[i]);
+        const __m256 r01 = _mm256_loadu_ps(r), r23 = _mm256_loadu_ps(r + 8);
+        float* o = columns(out[i]);
+        _mm256_storeu_ps(o, combineAffineAVX2(l0, l1, l2, r01));
+        _mm256_storeu_ps(o + 8, _mm256_add_ps(combineAffineAVX2(l0, l1, l2, r23), l3));
+        if (translation != nullptr) translation[i] = glm::vec3(o[12], o[13], o[14]);
+    }
+}
+
+#endif
+
+static bool closeEnough(const glm::mat4 &a, const glm::mat4 &b) {
+    const float tolerance = 1e-5f; // Relative, the SIMD kernels sum in a different order (and with fma)
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            if (std::abs(a[c][r] - b[c][r]) > tolerance * std::max(1.0f, std::abs(b[c][r]))) return false;
+        }
+    }
+    return true;
+}
+
+/// Run both kernels on fixed pseudo random matrices and compare them to the scalar kernels
+static bool verifyMatrixKernels(MatrixBatchKernel multiply, AffineBatchKernel affine) {
+    Random random(2468);
+    auto nextFloat = [&random]() { return random.nextFloat() * 8.0f - 4.0f; };
+    auto nextMatrix = [&nextFloat](bool isAffine) {
+        glm::mat4 m;
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) m[c][r] = nextFloat();
+            if (isAffine) m[c][3] = c == 3 ? 1.0f : 0.0f;
+        }
+        return m;
+    };
+
+    const unsigned int count = 7;
+    glm::mat4 lhs = nextMatrix(false);
+    glm::mat4 parents[3] = {nextMatrix(true), nextMatrix(true), glm::mat4(1.0f)};
+    const glm::mat4* parent[count];
+    glm::mat4 rhs[count], local[count], expected[count], actual[count];
+    glm::vec3 expectedTranslation[count], actualTranslation[count];
+    for (unsigned int i = 0; i < count; i++) {
+        rhs[i] = nextMatrix(false);
+        local[i] = nextMatrix(true);
+        parent[i] = &parents[i % 3];
+    }
+
+    multiplyMatricesScalar(lhs, rhs, expected, count);
+    multiply(lhs, rhs, actual, count);
+    for (unsigned int i = 0; i < count; i++) {
+        if (!closeEnough(actual[i], expected[i])) return false;
+    }
+
+    multiplyAffineScalar(parent, local, expected, expectedTranslation, count);
+    affine(parent, local, actual, actualTranslation, count);
+    for (unsigned int i = 0; i < count; i++) {
+        if (!closeEnough(actual[i], expected[i]) || actualTranslation[i] != glm::vec3(actual[i][3])) return false;
+    }
+    return true;
+}
+
+struct MatrixKernels {
+    MatrixBatchKernel multiply;
+    AffineBatchKernel affine;
+};
+
+static const SelectedKernels<MatrixKernels> &selectedMatrixKernels() {
+    static const SelectedKernels<MatrixKernels> selected = selectKernels<MatrixKernels>("Matrix batch",
+            {GLOWBOX_SIMD_OR_SCALAR(multiplyMatricesAVX2, multiplyMatricesScalar), GLOWBOX_SIMD_OR_SCALAR(multiplyAffineAVX2, multiplyAffineScalar)},
+            {GLOWBOX_SIMD_OR_SCALAR(multiplyMatricesSSE, multiplyMatricesScalar), GLOWBOX_SIMD_OR_SCALAR(multiplyAffineSSE, multiplyAffineScalar)},
+            {multiplyMatricesScalar, multiplyAffineScalar},
+            [](const MatrixKernels &k) { return verifyMatrixKernels(k.multiply, k.affine); });
+    return selected;
+}
+
+void multiplyMatrixBatch(const glm::mat4 &lhs, const glm::mat4* rhs, glm::mat4* out, unsigned int count) {
+    selectedMatrixKernels().kernels.multiply(lhs, rhs, out, count);
+}
+
+void multiplyAffineBatch(const glm::mat4* const* lhs, const glm::mat4* rhs, glm::mat4* out,
+                         glm::vec3* translation, unsigned int count) {
+    selectedMatrixKernels().kernels.affine(lhs, rhs, out, translation, count);
+}
+
+const char* getMatrixBatchKernelName() {
+    return selectedMatrixKernels().name;
+}
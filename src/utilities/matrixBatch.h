@@ -0,0 +1,31 @@
+#ifndef GLOWBOX_MATRIXBATCH_H
+#define GLOWBOX_MATRIXBATCH_H
+
+#include <glm/glm.hpp>
+#include "cpuFeatures.h"
+
+// Batched 4x4 matrix products for the transform passes, one call per array instead of one glm product per node
+
+// out[i] = lhs * rhs[i], such as VP * M for a run of nodes
+typedef void (*MatrixBatchKernel)(const glm::mat4 &lhs, const glm::mat4* rhs, glm::mat4* out, unsigned int count);
+// out[i] = *lhs[i] * rhs[i] for affine matrices (bottom row 0 0 0 1), such as parent world * local
+// The translation of every product (the world position) is written to translation, unless it is nullptr
+typedef void (*AffineBatchKernel)(const glm::mat4* const* lhs, const glm::mat4* rhs, glm::mat4* out,
+                                  glm::vec3* translation, unsigned int count);
+
+void multiplyMatricesScalar(const glm::mat4 &lhs, const glm::mat4* rhs, glm::mat4* out, unsigned int count);
+void multiplyAffineScalar(const glm::mat4* const* lhs, const glm::mat4* rhs, glm::mat4* out, glm::vec3* translation, unsigned int count);
+#ifdef GLOWBOX_X86 // The SIMD kernels only exist on x86
+void multiplyMatricesSSE(const glm::mat4 &lhs, const glm::mat4* rhs, glm::mat4* out, unsigned int count);
+void multiplyMatricesAVX2(const glm::mat4 &lhs, const glm::mat4* rhs, glm::mat4* out, unsigned int count);
+void multiplyAffineSSE(const glm::mat4* const* lhs, const glm::mat4* rhs, glm::mat4* out, glm::vec3* translation, unsigned int count);
+void multiplyAffineAVX2(const glm::mat4* const* lhs, const glm::mat4* rhs, glm::mat4* out, glm::vec3* translation, unsigned int count);
+#endif
+
+// Widest kernels supported by the cpu, selected (and verified against the scalar kernels) on first use
+void multiplyMatrixBatch(const glm::mat4 &lhs, const glm::mat4* rhs, glm::mat4* out, unsigned int count);
+void multiplyAffineBatch(const glm::mat4* const* lhs, const glm::mat4* rhs, glm::mat4* out,
+                         glm::vec3* translation, unsigned int count);
+const char* getMatrixBatchKernelName();
+
+#endif //GLOWBOX_MATRIXBATCH_H
@@ -0,0 +1,43 @@
+#ifndef GLOWBOX_PARALLELFOR_H
+#define GLOWBOX_PARALLELFOR_H
+
+#include "taskScheduler.h"
+#include <algorithm>
+
+/// Run body(chunkBegin, chunkEnd) over [begin, end), split into a few contiguous chunks per thread
+/// For bodies that process a range at a time (batched kernels). The chunks are spawned as tasks and the calling
+/// thread works on them too while waiting, so it can be nested inside another task.
+template<typename F>
+void parallelForChunks(TaskScheduler &scheduler, unsigned int begin, unsigned int end, const F &body,
+                       unsigned int chunksPerWorker = 4, unsigned int minChunkSize = 16) {
+    if (end <= begin) return;
+    const unsigned int count = end - begin;
+    const unsigned int threads = scheduler.workerCount() + 1;
+    const unsigned int chunkSize = std::max(minChunkSize, count / (threads * chunksPerWorker) + 1);
+    if (chunkSize >= count) {
+        body(begin, end);
+        return;
+    }
+
+    TaskGroup group;
+    for (unsigned int chunkBegin = begin; chunkBegin < end; chunkBegin += chunkSize) {
+        const unsigned int chunkEnd = std::min(end, chunkBegin + chunkSize);
+        scheduler.run(group, [&body, chunkBegin, chunkEnd]() {
+            body(chunkBegin, chunkEnd);
+        });
+    }
+    scheduler.wait(group);
+}
+
+/// Run body(i) for every i in [begin, end), split into a few contiguous chunks per thread
+/// The chunks are spawned as tasks and the calling thread works on them too while waiting,
+/// so parallelFor can be nested inside another task (like the recursive scene graph update).
+template<typename F>
+void parallelFor(TaskScheduler &scheduler, unsigned int begin, unsigned int end, const F &body,
+                 unsigned int chunksPerWorker = 4, unsigned int minChunkSize = 16) {
+    parallelForChunks(scheduler, begin, end, [&body](unsigned int chunkBegin, unsigned int chunkEnd) {
+        for (unsigned int i = chunkBegin; i < chunkEnd; i++) body(i);
+    }, chunksPerWorker, minChunkSize);
+}
+
+#endif //GLOWBOX_PARALLELFOR_H
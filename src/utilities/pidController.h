@@ -0,0 +1,45 @@
+#ifndef GLOWBOX_PIDCONTROLLER_H
+#define GLOWBOX_PIDCONTROLLER_H
+
+#include <algorithm>
+
+// Positional PID controller, output = kp*e + ki*integral(e) + kd*de/dt
+// The output is clamped to [outputMin, outputMax], and the integral stops growing while the output is held at a limit
+// (anti windup), so the controller leaves a limit as soon as the error changes sign
+class PidController {
+private:
+    float kp, ki, kd;
+    float outputMin, outputMax;
+    float integral = 0.0f;
+    float previousError = 0.0f;
+    bool hasPrevious = false;
+
+public:
+    PidController(float kp, float ki, float kd, float outputMin, float outputMax)
+        : kp(kp), ki(ki), kd(kd), outputMin(outputMin), outputMax(outputMax) {}
+
+    void setOutputLimits(float min, float max) { outputMin = min; outputMax = max; }
+
+    // Start over from output, as if the controller had settled there
+    void reset(float output = 0.0f) {
+        integral = ki != 0.0f ? output / ki : 0.0f;
+        previousError = 0.0f;
+        hasPrevious = false;
+    }
+
+    float update(float error, float dt) {
+        const float derivative = hasPrevious && dt > 0.0f ? (error - previousError) / dt : 0.0f;
+        previousError = error;
+        hasPrevious = true;
+
+        integral += error * dt;
+        float output = kp * error + ki * integral + kd * derivative;
+        if ((output > outputMax && error > 0.0f) || (output < outputMin && error < 0.0f)) {
+            integral -= error * dt; // Saturated and pushing further, undo the integration
+            output = kp * error + ki * integral + kd * derivative;
+        }
+        return std::max(outputMin, std::min(output, outputMax));
+    }
+};
+
+#endif //GLOWBOX_PIDCONTROLLER_H
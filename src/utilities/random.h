@@ -0,0 +1,48 @@
+#ifndef GLOWBOX_RANDOM_H
+#define GLOWBOX_RANDOM_H
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Small seeded random generator (xorshift64*), one per user instead of the shared global rand() state
+// Each ship owns one, so the random numbers it draws do not depend on which thread updates it or in what order
+class Random {
+private:
+    uint64_t state;
+
+public:
+    // The seed is mixed (splitmix64) so nearby seeds, like consecutive ship ids, give unrelated sequences
+    explicit Random(uint64_t seed = 1) {
+        uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        state = (z ^ (z >> 31)) | 1; // Never zero
+    }
+
+    uint32_t next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (uint32_t) ((state * 0x2545F4914F6CDD1Dull) >> 32);
+    }
+
+    // Uniform in [0, 1)
+    float nextFloat() { return (float) (next() >> 8) * (1.0f / 16777216.0f); }
+
+    // Uniform in [min, max)
+    glm::vec3 linearRand(const glm::vec3 &min, const glm::vec3 &max) {
+        glm::vec3 t(nextFloat(), nextFloat(), nextFloat());
+        return min + t * (max - min);
+    }
+
+    // Uniform inside a ball, like glm::ballRand
+    glm::vec3 ballRand(float radius) {
+        glm::vec3 v;
+        do {
+            v = linearRand(glm::vec3(-1.0f), glm::vec3(1.0f));
+        } while (glm::dot(v, v) > 1.0f);
+        return v * radius;
+    }
+};
+
+#endif //GLOWBOX_RANDOM_H
@@ -0,0 +1,43 @@
+#include "spatialGrid.h"
+
+void SpatialGrid::rebuild(const float* x, const float* y, const float* z, unsigned int count, float newCellSize,
+                          const unsigned char* flags, unsigned char requiredFlags) {
+    cellSize = newCellSize;
+    invCellSize = 1.0f / newCellSize;
+
+    // Power of two table with at least twice as many buckets as entries, keeps the buckets short
+    unsigned int tableSize = 64;
+    while (tableSize < count * 2) tableSize *= 2;
+    tableMask = tableSize - 1;
+
+    const unsigned int skipped = ~0u;
+    unsigned int n = 0;
+    cellStart.assign(tableSize + 1, 0);
+    hashes.resize(count);
+
+    // Counting sort on bucket
+    for (unsigned int i = 0; i < count; i++) {
+        if (flags != nullptr && (flags[i] & requiredFlags) != requiredFlags) {
+            hashes[i] = skipped;
+            continue;
+        }
+        hashes[i] = hashCell(cellOf(glm::vec3(x[i], y[i], z[i])));
+        cellStart[hashes[i] + 1]++;
+        n++;
+    }
+    entries.resize(n);
+    for (unsigned int b = 0; b < tableSize; b++) {
+        cellStart[b + 1] += cellStart[b];
+    }
+
+    // Scatter, cellStart is used as a cursor and restored afterwards
+    for (unsigned int i = 0; i < count; i++) {
+        if (hashes[i] == skipped) continue;
+        unsigned int slot = cellStart[hashes[i]]++;
+        entries[slot] = i;
+    }
+    for (unsigned int b = tableSize; b > 0; b--) {
+        cellStart[b] = cellStart[b - 1];
+    }
+    cellStart[0] = 0;
+}
@@ -0,0 +1,111 @@
+#ifndef GLOWBOX_SPATIALGRID_H
+#define GLOWBOX_SPATIALGRID_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+struct GridCell {
+    int x, y, z;
+};
+
+inline bool operator==(const GridCell &a, const GridCell &b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// Uniform spatial hash grid for fixed-radius neighbour queries
+// Rebuilt from scratch once per frame (counting sort, O(n)), so no incremental bookkeeping is needed
+// Entries are referenced by their index in the position arrays given to rebuild()
+class SpatialGrid {
+private:
+    float cellSize = 1.0f;
+    float invCellSize = 1.0f;
+
+    unsigned int tableMask = 0;
+    std::vector<unsigned int> cellStart;  // Hash bucket -> first entry, size is table size + 1
+    std::vector<unsigned int> entries;    // Entry indices, sorted by hash bucket
+    std::vector<unsigned int> hashes;     // Scratch buffer, bucket of each input position
+
+    unsigned int hashCell(const GridCell &c) const {
+        // Large primes from "Optimized Spatial Hashing for Collision Detection of Deformable Objects" (Teschner et al.)
+        return (((unsigned int) c.x * 73856093u) ^ ((unsigned int) c.y * 19349663u) ^ ((unsigned int) c.z * 83492791u)) & tableMask;
+    }
+
+public:
+    GridCell cellOf(const glm::vec3 &pos) const {
+        return GridCell{(int) std::floor(pos.x * invCellSize),
+                        (int) std::floor(pos.y * invCellSize),
+                        (int) std::floor(pos.z * invCellSize)};
+    }
+
+    float getCellSize() const { return cellSize; }
+    unsigned int size() const { return (unsigned int) entries.size(); }
+
+    /// @param flags optional per entry flags, entries without all of requiredFlags set are left out of the grid
+    void rebuild(const float* x, const float* y, const float* z, unsigned int count, float newCellSize,
+                 const unsigned char* flags = nullptr, unsigned char requiredFlags = 0);
+
+    /// Visit the raw hash buckets overlapping the query sphere, each bucket only once
+    /// The buckets can hold entries outside the radius (or from other cells), so the callback must do the distance test
+    /// Allocation free, but limited to radius <= cell size (3 cells per axis, 4 when the bounds round onto a cell edge)
+    /// @param callback called as callback(const unsigned int* indices, unsigned int count)
+    template<typename F>
+    void forEachBucketInRadius(const glm::vec3 &center, float radius, F &&callback) const {
+        if (entries.empty()) return;
+        assert(radius <= cellSize);
+        GridCell lo = cellOf(center - glm::vec3(radius));
+        GridCell hi = cellOf(center + glm::vec3(radius));
+        assert(hi.x - lo.x < 4 && hi.y - lo.y < 4 && hi.z - lo.z < 4);
+
+        unsigned int visited[64];
+        unsigned int visitedCount = 0;
+        for (int z = lo.z; z <= hi.z; z++)
+        for (int y = lo.y; y <= hi.y; y++)
+        for (int x = lo.x; x <= hi.x; x++) {
+            unsigned int bucket = hashCell(GridCell{x, y, z});
+            bool seen = false;
+            for (unsigned int i = 0; i < visitedCount; i++) seen |= visited[i] == bucket;
+            if (seen) continue; // Two cells of the query share a bucket
+            visited[visitedCount++] = bucket;
+
+            unsigned int count = cellStart[bucket + 1] - cellStart[bucket];
+            if (count > 0) callback(entries.data() + cellStart[bucket], count);
+        }
+    }
+
+    /// Visit the raw hash buckets of the cells a segment passes through, with the cells grown by margin
+    /// Entries extending at most margin outside their cell (like bounding boxes) are found if the segment touches them
+    /// As with forEachBucketInRadius the buckets hold other entries as well, and a bucket can be visited more than once
+    /// @param direction unit direction of the segment, starting at origin
+    /// @param callback called as callback(const unsigned int* indices, unsigned int count)
+    template<typename F>
+    void forEachBucketAlongSegment(const glm::vec3 &origin, const glm::vec3 &direction, float length, float margin,
+                                   F &&callback) const {
+        if (entries.empty()) return;
+        const glm::vec3 end = origin + direction * length;
+        GridCell lo = cellOf(glm::min(origin, end) - glm::vec3(margin));
+        GridCell hi = cellOf(glm::max(origin, end) + glm::vec3(margin));
+        const glm::vec3 frac = 1.0f / direction;
+
+        for (int z = lo.z; z <= hi.z; z++)
+        for (int y = lo.y; y <= hi.y; y++)
+        for (int x = lo.x; x <= hi.x; x++) {
+            // Slab test of the segment against the grown cell, most cells of the bounding volume are skipped here
+            glm::vec3 cellMin = glm::vec3((float) x, (float) y, (float) z) * cellSize - glm::vec3(margin) - origin;
+            glm::vec3 cellMax = cellMin + glm::vec3(cellSize + 2.0f * margin);
+            glm::vec3 t1 = cellMin * frac, t2 = cellMax * frac;
+            glm::vec3 tNear = glm::min(t1, t2), tFar = glm::max(t1, t2);
+            float enter = std::max(std::max(std::max(tNear.x, tNear.y), tNear.z), 0.0f);
+            float exit = std::min(std::min(std::min(tFar.x, tFar.y), tFar.z), length);
+            if (enter > exit) continue;
+
+            unsigned int bucket = hashCell(GridCell{x, y, z});
+            unsigned int count = cellStart[bucket + 1] - cellStart[bucket];
+            if (count > 0) callback(entries.data() + cellStart[bucket], count);
+        }
+    }
+};
+
+#endif //GLOWBOX_SPATIALGRID_H
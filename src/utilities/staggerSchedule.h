@@ -0,0 +1,35 @@
+#ifndef GLOWBOX_STAGGERSCHEDULE_H
+#define GLOWBOX_STAGGERSCHEDULE_H
+
+#include <cstdint>
+
+// Spreads expensive per-entity work over several frames
+// A task with period k runs for each entity every k-th frame, in between the entity reuses its last result.
+// The entities are split into k round-robin buckets by a stable id, and one bucket is due each frame,
+// so the per frame cost of the task stays flat instead of spiking every k-th frame
+class StaggerSchedule {
+public:
+    enum Task : unsigned int {
+        NEIGHBOURS,      // Flocking sums of the neighbours
+        ANTI_COLLISION,  // Obstacle ray and escape direction fan
+        LASER_TARGETING, // Ray cast along the velocity when ready to fire
+        TASK_COUNT
+    };
+
+    static const unsigned int maxPeriod = 16;
+
+    void advance() { frame++; } // Once per simulation step, before the entities are updated
+
+    bool isDue(Task task, unsigned int id) const { return (id + frame) % period[task] == 0; }
+
+    unsigned int getPeriod(Task task) const { return period[task]; }
+    // Can be changed between steps, the buckets follow the new period from the next step
+    void setPeriod(Task task, unsigned int k) { period[task] = k < 1 ? 1 : (k > maxPeriod ? maxPeriod : k); }
+    void setAllPeriods(unsigned int k) { for (unsigned int t = 0; t < TASK_COUNT; t++) setPeriod((Task) t, k); }
+
+private:
+    uint64_t frame = 0;
+    unsigned int period[TASK_COUNT] = {2, 1, 1}; // Neighbours every other frame, as the old half sampling did
+};
+
+#endif //GLOWBOX_STAGGERSCHEDULE_H
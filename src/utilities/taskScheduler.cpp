@@ -0,0 +1,161 @@
+#include "taskScheduler.h"
+#include <algorithm>
+#include <cstdio>
+
+#if defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#elif defined(_WIN32)
+    #define NOMINMAX
+    #include <windows.h>
+#endif
+
+// Worker threads remember which scheduler and deque they belong to
+static thread_local const TaskScheduler* currentScheduler = nullptr;
+static thread_local unsigned int currentQueue = 0;
+
+static void pinThreadToCore(std::thread &thread, unsigned int core) {
+    // With more workers than cores the extra workers share cores, hardware_concurrency() is 0 when unknown
+    core %= std::max(std::thread::hardware_concurrency(), 1u);
+#if defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core % CPU_SETSIZE, &cpuSet);
+    if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuSet) != 0) {
+        fprintf(stderr, "Could not pin worker thread to core %u\n", core);
+    }
+#elif defined(_WIN32)
+    SetThreadAffinityMask(thread.native_handle(), (DWORD_PTR) 1 << (core % (sizeof(DWORD_PTR) * 8)));
+#else
+    (void) thread;
+    (void) core;
+#endif
+}
+
+TaskScheduler::TaskScheduler(unsigned int workerCount, bool pinThreads) {
+    if (workerCount == 0) {
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    for (unsigned int i = 0; i < workerCount + 1; i++) {
+        queues.emplace_back(new WorkQueue());
+    }
+    for (unsigned int i = 0; i < workerCount; i++) {
+        workers.emplace_back(&TaskScheduler::workerLoop, this, i);
+        if (pinThreads) pinThreadToCore(workers.back(), i + 1); // Core 0 is left for the main thread
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stop = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned int TaskScheduler::queueIndexOfThisThread() const {
+    return currentScheduler == this ? currentQueue : (unsigned int) queues.size() - 1;
+}
+
+void TaskScheduler::run(TaskGroup &group, std::function<void()> function) {
+    group.pending.fetch_add(1);
+    WorkQueue &queue = *queues[queueIndexOfThisThread()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        // Counted before it can be popped, so the count never drops below the number of queued tasks
+        queuedTasks.fetch_add(1);
+        queue.tasks.push_back(Task{std::move(function), &group});
+    }
+
+    // Taking the lock makes sure a worker (or waiter) about to sleep sees the new task
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wakeUp.notify_one();
+    helpOut.notify_all();
+}
+
+bool TaskScheduler::popOrSteal(unsigned int queueIndex, Task &task) {
+    if (queuedTasks.load() == 0) return false;
+
+    // Own queue first, newest task
+    {
+        WorkQueue &own = *queues[queueIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            queuedTasks.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // Steal the oldest task of another queue, starting with the neighbour to spread out the thieves
+    const unsigned int n = (unsigned int) queues.size();
+    for (unsigned int offset = 1; offset < n; offset++) {
+        WorkQueue &victim = *queues[(queueIndex + offset) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            queuedTasks.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::execute(Task &task) {
+    try {
+        task.function();
+    } catch (...) {
+        // Handed to wait(), the task still counts as finished so the group does not hang
+        std::lock_guard<std::mutex> lock(task.group->exceptionMutex);
+        if (!task.group->exception) task.group->exception = std::current_exception();
+    }
+    if (task.group->pending.fetch_sub(1) == 1) {
+        // Last task of the group, taking the lock makes sure a waiter about to sleep sees it
+        { std::lock_guard<std::mutex> lock(sleepMutex); }
+        helpOut.notify_all();
+    }
+}
+
+void TaskScheduler::workerLoop(unsigned int index) {
+    currentScheduler = this;
+    currentQueue = index;
+
+    Task task;
+    while (true) {
+        if (popOrSteal(index, task)) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this] { return stop.load() || queuedTasks.load() > 0; });
+        if (stop && queuedTasks.load() == 0) return;
+    }
+}
+
+void TaskScheduler::wait(TaskGroup &group) {
+    const unsigned int queueIndex = queueIndexOfThisThread();
+    Task task;
+    while (group.pending.load() > 0) {
+        if (popOrSteal(queueIndex, task)) {
+            execute(task);
+            continue;
+        }
+        // The remaining tasks of the group are running on other threads
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        helpOut.wait(lock, [this, &group] { return group.pending.load() == 0 || queuedTasks.load() > 0; });
+    }
+
+    // Every task of the group is done, nothing else touches the exception anymore
+    if (group.exception) {
+        std::exception_ptr exception = group.exception;
+        group.exception = nullptr;
+        std::rethrow_exception(exception);
+    }
+}
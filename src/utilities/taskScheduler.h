@@ -0,0 +1,71 @@
+#ifndef GLOWBOX_TASKSCHEDULER_H
+#define GLOWBOX_TASKSCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the unfinished tasks started with TaskScheduler::run, waited on with TaskScheduler::wait
+// The first exception thrown by one of its tasks is kept and rethrown by wait()
+class TaskGroup {
+private:
+    friend class TaskScheduler;
+    std::atomic<unsigned int> pending{0};
+    std::mutex exceptionMutex;
+    std::exception_ptr exception;
+};
+
+// Work stealing task scheduler
+// Every worker owns a deque: it pushes and pops its own tasks at the back (newest first, cache warm),
+// and idle threads steal from the front of the other deques (oldest first, usually the biggest pieces of work).
+// Threads that are not workers (the main thread) push to a shared queue that the workers steal from as well.
+// wait() runs other tasks while the group is unfinished, so tasks can spawn and wait on tasks recursively
+// without tying up a thread. When there is nothing left to run it sleeps until the group finishes or a task is queued.
+class TaskScheduler {
+private:
+    struct Task {
+        std::function<void()> function;
+        TaskGroup* group;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues; // One per worker, the last one is shared by all other threads
+
+    std::atomic<unsigned int> queuedTasks{0}; // Only changed while holding the lock of the queue it counts
+    std::atomic<bool> stop{false};
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;  // Idle workers
+    std::condition_variable helpOut; // Threads in wait()
+
+    unsigned int queueIndexOfThisThread() const;
+    bool popOrSteal(unsigned int queueIndex, Task &task);
+    void execute(Task &task);
+    void workerLoop(unsigned int index);
+
+public:
+    /// @param workerCount number of worker threads, 0 for one per hardware thread (minus the calling thread, at least 1)
+    /// @param pinThreads pin worker i to core i + 1 (core 0 is left for the main thread), only supported on linux and windows
+    explicit TaskScheduler(unsigned int workerCount = 0, bool pinThreads = false);
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler &) = delete;
+    TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+    unsigned int workerCount() const { return (unsigned int) workers.size(); }
+
+    void run(TaskGroup &group, std::function<void()> function);
+    void wait(TaskGroup &group); // Helps out with queued tasks until the group is done, rethrows a task's exception
+};
+
+#endif //GLOWBOX_TASKSCHEDULER_H
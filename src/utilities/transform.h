@@ -0,0 +1,60 @@
+#ifndef GLOWBOX_TRANSFORM_H
+#define GLOWBOX_TRANSFORM_H
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+
+// Closed form versions of the matrix products used for the scene and the ships
+
+// Columns of rotate(y) * rotate(x) * rotate(z), the Euler order used by SceneNode
+struct EulerBasis {
+    glm::vec3 right, up, front;
+};
+
+inline EulerBasis eulerBasis(const glm::vec3 &rotation) {
+    const float sx = std::sin(rotation.x), cx = std::cos(rotation.x);
+    const float sy = std::sin(rotation.y), cy = std::cos(rotation.y);
+    const float sz = std::sin(rotation.z), cz = std::cos(rotation.z);
+    EulerBasis b;
+    b.right = glm::vec3(cy*cz + sy*sx*sz, cx*sz, -sy*cz + cy*sx*sz);
+    b.up = glm::vec3(-cy*sz + sy*sx*cz, cx*cz, sy*sz + cy*sx*cz);
+    b.front = glm::vec3(sy*cx, -sx, cy*cx);
+    return b;
+}
+
+// translate(position) * translate(referencePoint) * rotate(y) * rotate(x) * rotate(z) * scale(scale) * translate(-referencePoint)
+// written out, instead of seven 4x4 products
+inline glm::mat4 composeTRS(const glm::vec3 &position, const glm::vec3 &rotation, const glm::vec3 &scale,
+                            const glm::vec3 &referencePoint = glm::vec3(0.0f)) {
+    const EulerBasis b = eulerBasis(rotation);
+    const glm::vec3 x = b.right * scale.x;
+    const glm::vec3 y = b.up * scale.y;
+    const glm::vec3 z = b.front * scale.z;
+    const glm::vec3 t = position + referencePoint - (x * referencePoint.x + y * referencePoint.y + z * referencePoint.z);
+    glm::mat4 m(1.0f);
+    m[0] = glm::vec4(x, 0.0f);
+    m[1] = glm::vec4(y, 0.0f);
+    m[2] = glm::vec4(z, 0.0f);
+    m[3] = glm::vec4(t, 1.0f);
+    return m;
+}
+
+// transpose(inverse(M)) of the upper 3x3, for transforming normals
+// Rotations with any scale along the rotated axes (every chain of uniform scales included) leave the columns
+// orthogonal, then the inverse transpose is every column divided by its squared length.
+// Shears (non uniform scale under a rotation further down the chain) take the general inverse
+inline glm::mat3 normalMatrix(const glm::mat4 &m) {
+    const glm::vec3 a(m[0]), b(m[1]), c(m[2]);
+    const float aa = glm::dot(a, a), bb = glm::dot(b, b), cc = glm::dot(c, c);
+    const float tolerance = 1e-5f;
+    if (aa > 0.0f && bb > 0.0f && cc > 0.0f
+        && std::abs(glm::dot(a, b)) <= tolerance * std::sqrt(aa * bb)
+        && std::abs(glm::dot(a, c)) <= tolerance * std::sqrt(aa * cc)
+        && std::abs(glm::dot(b, c)) <= tolerance * std::sqrt(bb * cc)) {
+        return glm::mat3(a / aa, b / bb, c / cc);
+    }
+    return glm::transpose(glm::inverse(glm::mat3(m)));
+}
+
+#endif //GLOWBOX_TRANSFORM_H
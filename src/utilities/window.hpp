@@ -14,4 +14,15 @@ const GLint       windowResizable = GL_FALSE;
 const int         windowSamples   = 4;
 
 struct CommandLineOptions {
+    unsigned int workerThreads = 0; // 0 picks one per hardware thread
+    bool pinThreads = false;
+
+    // Deterministic mode: the simulation advances in fixed ticks instead of the frame time
+    bool fixedTimeStep = false;
+    unsigned int tickRate = 60; // Ticks per second
+    unsigned int seed = 0; // 0 picks a random seed
+
+    unsigned int escapeDirections = 40; // Escape paths a ship tests when avoiding an obstacle
+
+    float frameBudgetMs = 12.0f; // Simulation and render time per frame the adaptive ship count aims for
 };
\ No newline at end of file